@@ -0,0 +1,132 @@
+#include "bench_mode.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+
+static char report_buf[4096];
+static size_t report_len = 0;
+
+// Fake sink: frames are copied here and the copy is timed, standing in
+// for the socket send without any network variance
+static uint8_t *sink_buf = NULL;
+static size_t sink_cap = 0;
+
+static const framesize_t bench_sizes[] = {
+  FRAMESIZE_QVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA
+};
+static const int bench_quals[] = { 10, 14, 20, 30 };
+
+static bool bench_cell(sensor_t *s, framesize_t size, int quality) {
+  s->set_framesize(s, size);
+  s->set_quality(s, quality);
+
+  // Let exposure and the pipeline settle on the new configuration
+  for (int i = 0; i < 5; i++) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb) esp_camera_fb_return(fb);
+  }
+
+  uint32_t frames = 0;
+  uint64_t capture_us_sum = 0;
+  uint64_t bytes_sum = 0;
+  uint64_t sink_us_sum = 0;
+  uint32_t min_heap = esp_get_free_heap_size();
+
+  int64_t cell_end = esp_timer_get_time() + (int64_t)BENCH_CELL_SECONDS * 1000000;
+  while (esp_timer_get_time() < cell_end) {
+    int64_t t0 = esp_timer_get_time();
+    camera_fb_t *fb = esp_camera_fb_get();
+    int64_t t1 = esp_timer_get_time();
+    if (!fb) continue;
+
+    capture_us_sum += t1 - t0;
+    bytes_sum += fb->len;
+    if (sink_buf && fb->len <= sink_cap) {
+      memcpy(sink_buf, fb->buf, fb->len);
+      sink_us_sum += esp_timer_get_time() - t1;
+    }
+    esp_camera_fb_return(fb);
+    frames++;
+
+    uint32_t heap = esp_get_free_heap_size();
+    if (heap < min_heap) min_heap = heap;
+  }
+
+  if (frames == 0) {
+    return false;
+  }
+
+  uint32_t avg_capture_us = capture_us_sum / frames;
+  uint32_t avg_bytes = bytes_sum / frames;
+  uint32_t fps_x10 = frames * 10 / BENCH_CELL_SECONDS;
+  uint32_t sink_kbps = sink_us_sum ? (bytes_sum * 8000) / sink_us_sum : 0;
+
+  report_len += snprintf(report_buf + report_len, sizeof(report_buf) - report_len,
+                         "%s{\"framesize\":%d,\"quality\":%d,\"frames\":%u,"
+                         "\"fps\":%u.%u,\"avg_capture_us\":%u,\"avg_bytes\":%u,"
+                         "\"sink_kbps\":%u,\"min_heap\":%u}",
+                         report_len > 0 && report_buf[report_len - 1] == '}' ? "," : "",
+                         (int)size, quality, frames, fps_x10 / 10, fps_x10 % 10,
+                         avg_capture_us, avg_bytes, sink_kbps, min_heap);
+
+  Serial.printf("bench: size=%d q=%d frames=%u fps=%u.%u capture=%uus bytes=%u sink=%ukbps heap=%u\n",
+                (int)size, quality, frames, fps_x10 / 10, fps_x10 % 10,
+                avg_capture_us, avg_bytes, sink_kbps, min_heap);
+  return true;
+}
+
+bool bench_mode_run() {
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) {
+    Serial.println("bench: sensor not available");
+    return false;
+  }
+
+  sink_cap = 128 * 1024;
+  sink_buf = psramFound() ? (uint8_t *)ps_malloc(sink_cap)
+                          : (uint8_t *)malloc(24 * 1024);
+  if (sink_buf && !psramFound()) sink_cap = 24 * 1024;
+
+  int saved_framesize = s->status.framesize;
+  int saved_quality = s->status.quality;
+
+  Serial.println("=== Benchmark mode: running matrix ===");
+  report_len = snprintf(report_buf, sizeof(report_buf), "{\"results\":[");
+
+  for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+    if (!psramFound() && bench_sizes[i] > FRAMESIZE_VGA) continue;
+    for (size_t j = 0; j < sizeof(bench_quals) / sizeof(bench_quals[0]); j++) {
+      bench_cell(s, bench_sizes[i], bench_quals[j]);
+    }
+  }
+
+  report_len += snprintf(report_buf + report_len, sizeof(report_buf) - report_len,
+                         "]}");
+
+  s->set_framesize(s, (framesize_t)saved_framesize);
+  s->set_quality(s, saved_quality);
+
+  if (sink_buf) {
+    free(sink_buf);
+    sink_buf = NULL;
+  }
+
+  Serial.println("=== Benchmark report ===");
+  Serial.println(report_buf);
+  Serial.println("========================");
+  return true;
+}
+
+esp_err_t bench_json_handler(httpd_req_t *req) {
+  if (report_len == 0) {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No bench run recorded");
+    return ESP_FAIL;
+  }
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, report_buf, report_len);
+}
@@ -0,0 +1,27 @@
+/*********
+  Benchmark mode for the ESP32-CAM streaming server
+
+  Built into the esp32cam_bench PlatformIO environment (-DBENCH_MODE),
+  this runs a scripted matrix of frame sizes and JPEG qualities at boot
+  - before the streaming pipeline starts - measuring capture latency,
+  encoded size, copy throughput to a fake sink and minimum free heap.
+  The report is dumped over serial as JSON and served at /bench.json,
+  so releases can be gated on regressions.
+*********/
+
+#ifndef BENCH_MODE_H
+#define BENCH_MODE_H
+
+#include "esp_http_server.h"
+
+// Seconds spent in each matrix cell
+#define BENCH_CELL_SECONDS 3
+
+// Run the full matrix; call after esp_camera_init() and before
+// frame_broadcast_start(). Restores the sensor settings it found.
+bool bench_mode_run();
+
+// /bench.json URI handler; 404s until a bench run has completed
+esp_err_t bench_json_handler(httpd_req_t *req);
+
+#endif  // BENCH_MODE_H
@@ -0,0 +1,116 @@
+#include "espnow_sync.h"
+
+#include <string.h>
+
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+
+#include "Arduino.h"
+#include "esp_idf_version.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "stream_dispatch.h"  // shared stream_target_fps
+
+// The receive callback below uses the esp_now_recv_info_t signature
+// introduced in IDF 5; on an IDF 4.4 core (arduino-esp32 2.0.x) the
+// callback takes a bare MAC pointer and registration would not compile.
+// Fail with a pointer to the fix rather than a confusing prototype error.
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+#error "espnow_sync needs ESP-IDF 5.x / arduino-esp32 core 3.x - see the platform pin in platformio.ini"
+#endif
+
+#define SYNC_MAGIC 0x43544B31  // "1KTC"
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t seq;
+  int64_t master_us;
+} sync_tick_msg_t;
+
+volatile bool sync_enabled = false;
+
+static bool is_master = false;
+static volatile uint32_t tick_seq = 0;
+static SemaphoreHandle_t tick_sem = NULL;
+static TaskHandle_t master_task_handle = NULL;
+
+static const uint8_t broadcast_addr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static void on_tick_received(const esp_now_recv_info_t *info,
+                             const uint8_t *data, int len) {
+  if (len != sizeof(sync_tick_msg_t)) return;
+  const sync_tick_msg_t *msg = (const sync_tick_msg_t *)data;
+  if (msg->magic != SYNC_MAGIC) return;
+
+  tick_seq = msg->seq;
+  xSemaphoreGive(tick_sem);
+}
+
+// Master: broadcast a tick at the stream frame interval and gate the
+// local capture loop on the same tick, so both devices fire together
+static void master_tick_task(void *arg) {
+  sync_tick_msg_t msg;
+  msg.magic = SYNC_MAGIC;
+  msg.seq = 0;
+
+  while (true) {
+    if (!sync_enabled) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    msg.seq++;
+    msg.master_us = esp_timer_get_time();
+    esp_now_send(broadcast_addr, (const uint8_t *)&msg, sizeof(msg));
+    tick_seq = msg.seq;
+    xSemaphoreGive(tick_sem);
+    vTaskDelay(pdMS_TO_TICKS(1000 / stream_target_fps));
+  }
+}
+
+bool espnow_sync_start(bool master) {
+  is_master = master;
+  tick_sem = xSemaphoreCreateBinary();
+  if (!tick_sem) {
+    return false;
+  }
+
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("ESP-NOW init failed, sync unavailable");
+    return false;
+  }
+
+  if (master) {
+    esp_now_peer_info_t peer;
+    memset(&peer, 0, sizeof(peer));
+    memcpy(peer.peer_addr, broadcast_addr, 6);
+    peer.channel = 0;  // current WiFi channel
+    peer.ifidx = WIFI_IF_STA;
+    if (esp_now_add_peer(&peer) != ESP_OK) {
+      Serial.println("ESP-NOW peer add failed");
+      return false;
+    }
+    if (xTaskCreatePinnedToCore(master_tick_task, "sync_tick", 2048, NULL, 8,
+                                &master_task_handle, 1) != pdPASS) {
+      return false;
+    }
+  } else {
+    esp_now_register_recv_cb(on_tick_received);
+  }
+
+  Serial.printf("ESP-NOW sync ready (%s)\n", master ? "master" : "slave");
+  return true;
+}
+
+uint32_t espnow_sync_current_tick() {
+  return tick_seq;
+}
+
+void espnow_sync_wait_tick(TickType_t timeout) {
+  if (!sync_enabled || !tick_sem) {
+    return;
+  }
+  // Timeout means ticks stopped (master down or sync just enabled);
+  // free-run rather than starving the capture loop
+  xSemaphoreTake(tick_sem, timeout);
+}
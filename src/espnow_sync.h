@@ -0,0 +1,34 @@
+/*********
+  ESP-NOW capture sync for paired ESP32-CAM devices
+
+  A stereo rig needs both sensors to fire together, but two free-running
+  capture loops drift tens of milliseconds apart. The master device
+  (ESP32_CAM_1) broadcasts a capture tick over ESP-NOW - microsecond-
+  scale latency, no AP round trip - and both devices gate their capture
+  loop on it, stamping the shared tick number into the stream headers so
+  clients can pair frames exactly.
+*********/
+
+#ifndef ESPNOW_SYNC_H
+#define ESPNOW_SYNC_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Initialize ESP-NOW after WiFi is up. master selects the tick sender;
+// both roles start with sync disabled until /control?var=sync&val=1.
+bool espnow_sync_start(bool master);
+
+// Gating is off by default so a lone camera free-runs
+extern volatile bool sync_enabled;
+
+// Tick number of the most recent capture tick (0 before the first)
+uint32_t espnow_sync_current_tick();
+
+// Block the capture loop until the next tick. Returns immediately when
+// sync is disabled, and falls back to free-running (returns after the
+// timeout) if ticks stop arriving - a dead master must not blank the
+// camera.
+void espnow_sync_wait_tick(TickType_t timeout);
+
+#endif  // ESPNOW_SYNC_H
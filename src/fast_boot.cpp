@@ -0,0 +1,85 @@
+#include "fast_boot.h"
+
+#include <WiFi.h>
+#include <Preferences.h>
+
+#define FAST_BOOT_NAMESPACE "camboot"
+
+bool fast_boot_wifi_try(const char *ssid, const char *password, uint32_t timeout_ms) {
+  Preferences prefs;
+  if (!prefs.begin(FAST_BOOT_NAMESPACE, true)) {
+    return false;
+  }
+
+  uint8_t bssid[6];
+  int32_t channel = prefs.getInt("chan", 0);
+  size_t bssid_len = prefs.getBytes("bssid", bssid, sizeof(bssid));
+  uint32_t ip = prefs.getUInt("ip", 0);
+  uint32_t gw = prefs.getUInt("gw", 0);
+  uint32_t mask = prefs.getUInt("mask", 0);
+  uint32_t dns = prefs.getUInt("dns", 0);
+  prefs.end();
+
+  if (channel <= 0 || bssid_len != sizeof(bssid)) {
+    return false;  // nothing cached yet
+  }
+
+  // Reuse the last DHCP lease as a static config - skips the DHCP round
+  // trip. If the lease went stale the join below fails and the caller
+  // falls back to a full scan with DHCP.
+  if (ip && gw && mask) {
+    WiFi.config(IPAddress(ip), IPAddress(gw), IPAddress(mask), IPAddress(dns));
+  }
+
+  Serial.printf("Fast boot: rejoining cached AP on channel %d\n", (int)channel);
+  WiFi.begin(ssid, password, channel, bssid);
+
+  uint32_t start = millis();
+  while (WiFi.status() != WL_CONNECTED && millis() - start < timeout_ms) {
+    delay(10);
+  }
+
+  if (WiFi.status() == WL_CONNECTED) {
+    return true;
+  }
+
+  // Cached parameters are stale - reset to DHCP for the fallback path
+  WiFi.disconnect();
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  return false;
+}
+
+void fast_boot_wifi_save() {
+  Preferences prefs;
+  if (!prefs.begin(FAST_BOOT_NAMESPACE, false)) {
+    return;
+  }
+  prefs.putInt("chan", WiFi.channel());
+  prefs.putBytes("bssid", WiFi.BSSID(), 6);
+  prefs.putUInt("ip", (uint32_t)WiFi.localIP());
+  prefs.putUInt("gw", (uint32_t)WiFi.gatewayIP());
+  prefs.putUInt("mask", (uint32_t)WiFi.subnetMask());
+  prefs.putUInt("dns", (uint32_t)WiFi.dnsIP());
+  prefs.end();
+}
+
+void fast_boot_camera_save(int framesize, int quality) {
+  Preferences prefs;
+  if (!prefs.begin(FAST_BOOT_NAMESPACE, false)) {
+    return;
+  }
+  prefs.putInt("framesize", framesize);
+  prefs.putInt("quality", quality);
+  prefs.end();
+}
+
+bool fast_boot_camera_load(int *framesize, int *quality) {
+  Preferences prefs;
+  if (!prefs.begin(FAST_BOOT_NAMESPACE, true)) {
+    return false;
+  }
+  *framesize = prefs.getInt("framesize", -1);
+  *quality = prefs.getInt("quality", -1);
+  prefs.end();
+  return *framesize >= 0 && *quality >= 0;
+}
@@ -0,0 +1,27 @@
+/*********
+  NVS-backed fast boot for the ESP32-CAM streaming server
+
+  Caches the last successful WiFi association (BSSID, channel, DHCP
+  lease) and the runtime camera settings so a reboot skips the AP scan,
+  the DHCP round trip and the cold sensor reconfiguration. Target is
+  streaming again within ~3 s of reset instead of ~20 s.
+*********/
+
+#ifndef FAST_BOOT_H
+#define FAST_BOOT_H
+
+#include <stdint.h>
+
+// Try to rejoin the cached AP (known BSSID + channel, static copy of the
+// last DHCP lease) with a tight wait. Returns true when associated;
+// false means the caller should fall back to a normal scan-and-join.
+bool fast_boot_wifi_try(const char *ssid, const char *password, uint32_t timeout_ms);
+
+// Persist the current association after any successful connect
+void fast_boot_wifi_save();
+
+// Persisted runtime camera settings (set via /control, reapplied at boot)
+void fast_boot_camera_save(int framesize, int quality);
+bool fast_boot_camera_load(int *framesize, int *quality);
+
+#endif  // FAST_BOOT_H
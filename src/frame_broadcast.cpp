@@ -0,0 +1,542 @@
+#include "frame_broadcast.h"
+
+#include "Arduino.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "metrics.h"
+#include "replay_ring.h"
+#include "espnow_sync.h"
+#include "sensor_lock.h"
+#include "rtp_stream.h"
+#include "sd_recorder.h"
+
+// One ring per published variant; both share the ring mutex
+typedef struct {
+  frame_slot_t slots[FRAME_RING_SLOTS];
+  uint32_t latest_seq;
+} frame_ring_t;
+
+static frame_ring_t rings[FRAME_VARIANT_COUNT];  // indexed by frame_variant_t
+static SemaphoreHandle_t ring_mutex = NULL;
+static TaskHandle_t capture_task_handle = NULL;
+
+volatile int preview_clients = 0;
+volatile int analytics_clients = 0;
+
+volatile int analytics_width = 160;
+volatile int analytics_height = 120;
+volatile int analytics_crop_x = 0;
+volatile int analytics_crop_y = 0;
+volatile int analytics_crop_w = 0;
+volatile int analytics_crop_h = 0;
+
+volatile int idle_timeout_s = 30;
+static volatile int64_t last_active_us = 0;
+
+void frame_broadcast_touch() {
+  last_active_us = esp_timer_get_time();
+}
+
+volatile bool motion_gate_enabled = false;
+volatile int motion_keepalive_fps = 2;
+volatile int motion_threshold = 20;  // 2% aggregate block change
+volatile int bandwidth_budget_kbps = 0;
+
+// Closed-loop quality controller: once a second, compare the published
+// byte rate against the budget and step the sensor's quality setting by
+// one. On the OV2640 a higher quality number means more compression, so
+// over budget steps the number up. The 10% deadband keeps the
+// controller from oscillating on scenes that sit near the budget.
+static void adapt_quality(size_t frame_len) {
+  static int64_t window_start_us = 0;
+  static uint64_t window_bytes = 0;
+
+  window_bytes += frame_len;
+  int64_t now_us = esp_timer_get_time();
+  if (window_start_us == 0) {
+    window_start_us = now_us;
+    return;
+  }
+  if (now_us - window_start_us < 1000000) {
+    return;
+  }
+
+  uint32_t kbps = (uint32_t)((window_bytes * 8000) / (now_us - window_start_us));
+  window_start_us = now_us;
+  window_bytes = 0;
+
+  int budget = bandwidth_budget_kbps;
+  if (budget <= 0) return;
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) return;
+
+  sensor_lock();
+  int q = s->status.quality;
+  if (kbps > (uint32_t)budget + budget / 10 && q < 40) {
+    s->set_quality(s, q + 1);
+  } else if (kbps + budget / 10 < (uint32_t)budget && q > 8) {
+    s->set_quality(s, q - 1);
+  }
+  sensor_unlock();
+}
+
+#define MOTION_BLOCKS 16
+
+static uint32_t motion_prev_sums[MOTION_BLOCKS];
+static int64_t motion_last_publish_us = 0;
+
+// Cheap change detector over the compressed frame: sum sampled bytes in
+// MOTION_BLOCKS spans and compare with the previous frame. JPEG bytes
+// shift when scene content shifts, so a near-identical scene produces
+// near-identical sums while any real motion perturbs several blocks.
+static bool scene_changed(const uint8_t *buf, size_t len) {
+  uint32_t sums[MOTION_BLOCKS] = {0};
+  size_t span = len / MOTION_BLOCKS;
+  if (span < 16) return true;  // frame too small to judge, treat as motion
+
+  for (int b = 0; b < MOTION_BLOCKS; b++) {
+    const uint8_t *p = buf + b * span;
+    for (size_t i = 0; i < span; i += 13) {  // prime stride to avoid aliasing
+      sums[b] += p[i];
+    }
+  }
+
+  uint64_t diff = 0;
+  uint64_t total = 0;
+  for (int b = 0; b < MOTION_BLOCKS; b++) {
+    uint32_t prev = motion_prev_sums[b];
+    diff += (sums[b] > prev) ? sums[b] - prev : prev - sums[b];
+    total += prev;
+    motion_prev_sums[b] = sums[b];
+  }
+
+  if (total == 0) return true;
+  return (diff * 1000) / total > (uint64_t)motion_threshold;
+}
+
+// Fixed slot capacity, sized at startup so the steady-state stream loop
+// never touches the allocator. 128 KB covers UXGA at the qualities we
+// use; without PSRAM we only run up to VGA and 24 KB slots suffice.
+// Preview slots hold half-scale re-encodes (<= ~60 KB) and analytics
+// slots tiny crops, so they get smaller caps - every PSRAM consumer
+// (camera fbs, replay arena, rings, conversion and preview/analytics
+// scratch) has to fit the AI-Thinker's 4 MB together.
+#define FRAME_SLOT_CAP_PSRAM    (128 * 1024)
+#define FRAME_SLOT_CAP_PREVIEW  (64 * 1024)
+#define FRAME_SLOT_CAP_ANALYTICS (16 * 1024)
+#define FRAME_SLOT_CAP_INTERNAL (24 * 1024)
+
+// Copy a frame into a preallocated ring slot. Oversized frames are
+// dropped (and logged) rather than grown on the hot path.
+static bool slot_store(frame_slot_t *slot, const uint8_t *buf, size_t len,
+                       int64_t timestamp_us, uint32_t seq) {
+  if (slot->cap < len) {
+    Serial.printf("Frame too large for slot (%u > %u bytes), dropped\n",
+                  (unsigned)len, (unsigned)slot->cap);
+    return false;
+  }
+  memcpy(slot->buf, buf, len);
+  slot->len = len;
+  slot->timestamp_us = timestamp_us;
+  slot->sync_tick = espnow_sync_current_tick();
+  slot->seq = seq;
+  return true;
+}
+
+// Preallocated output buffer for JPEG conversion of non-JPEG pixel
+// formats; frame2jpg_cb() streams into it instead of malloc'ing a fresh
+// buffer per frame the way frame2jpg() does.
+typedef struct {
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+  bool overflow;
+} jpg_pool_t;
+
+static jpg_pool_t conv_pool;
+
+static size_t jpg_pool_write(void *arg, size_t index, const void *data, size_t len) {
+  jpg_pool_t *p = (jpg_pool_t *)arg;
+  if (index + len > p->cap) {
+    p->overflow = true;
+    return 0;
+  }
+  memcpy(p->buf + index, data, len);
+  if (index + len > p->len) p->len = index + len;
+  return len;
+}
+
+static uint8_t *pool_alloc(size_t size) {
+  return psramFound() ? (uint8_t *)ps_malloc(size) : (uint8_t *)malloc(size);
+}
+
+static void publish_frame(frame_variant_t variant, const uint8_t *buf,
+                          size_t len, int64_t timestamp_us) {
+  frame_ring_t *r = &rings[variant];
+
+  if (variant == FRAME_VARIANT_FULL && motion_gate_enabled) {
+    bool changed = scene_changed(buf, len);
+    int64_t now_us = esp_timer_get_time();
+    int64_t keepalive_us = 1000000 / (motion_keepalive_fps > 0 ? motion_keepalive_fps : 1);
+    if (!changed && now_us - motion_last_publish_us < keepalive_us) {
+      metric_frames_gated++;
+      return;  // static scene inside the keepalive window - skip this frame
+    }
+    motion_last_publish_us = now_us;
+  }
+
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+
+  // Pick the oldest slot nobody is sending. If every slot is held by a
+  // slow client the frame is dropped - capture must never block on send.
+  frame_slot_t *victim = NULL;
+  for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+    if (r->slots[i].refs > 0) continue;
+    if (!victim || r->slots[i].seq < victim->seq) victim = &r->slots[i];
+  }
+
+  bool stored = victim && slot_store(victim, buf, len, timestamp_us, r->latest_seq + 1);
+  if (stored) {
+    r->latest_seq++;
+  }
+
+  xSemaphoreGive(ring_mutex);
+
+  // Replay, metrics and the quality loop follow the full-rate stream only
+  if (stored && variant == FRAME_VARIANT_FULL) {
+    metric_frames_published++;
+    metric_hist_record(&metric_jpeg_bytes, len);
+    replay_ring_store(buf, len, timestamp_us, r->latest_seq);
+    adapt_quality(len);
+  }
+}
+
+// Half-scale preview: decode the published JPEG at 1/2 scale straight to
+// RGB565 (the decoder does the scaling, so no full-size intermediate),
+// then re-encode into the preview pool. Runs on core 0 and only while a
+// preview client is attached.
+static uint8_t *preview_rgb = NULL;
+static size_t preview_rgb_cap = 0;
+static jpg_pool_t preview_pool;
+
+static void make_preview(const uint8_t *jpg, size_t len, int64_t timestamp_us) {
+  if (!preview_rgb) return;
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) return;
+  uint16_t pw = resolution[s->status.framesize].width / 2;
+  uint16_t ph = resolution[s->status.framesize].height / 2;
+  if ((size_t)pw * ph * 2 > preview_rgb_cap) return;
+
+  if (!jpg2rgb565(jpg, len, preview_rgb, JPG_SCALE_2X)) {
+    return;
+  }
+  preview_pool.len = 0;
+  preview_pool.overflow = false;
+  if (!fmt2jpg_cb(preview_rgb, (size_t)pw * ph * 2, pw, ph, PIXFORMAT_RGB565,
+                  80, jpg_pool_write, &preview_pool) ||
+      preview_pool.overflow) {
+    return;
+  }
+  publish_frame(FRAME_VARIANT_PREVIEW, preview_pool.buf, preview_pool.len,
+                timestamp_us);
+}
+
+// Analytics variant: crop (optional) and downscale the half-scale RGB565
+// plane to the configured output size with a 16.16 fixed-point nearest
+// stepper, then re-encode. For a 160x120 feed from SVGA this cuts the
+// per-frame WiFi bytes by roughly 20x; the decode is the same half-scale
+// jpg2rgb565 the preview path uses, so the cost stays on core 0.
+#define ANALYTICS_MAX_W 320
+#define ANALYTICS_MAX_H 240
+
+static uint8_t *analytics_rgb = NULL;
+static jpg_pool_t analytics_pool;
+
+static void make_analytics(const uint8_t *jpg, size_t len, int64_t timestamp_us) {
+  if (!preview_rgb || !analytics_rgb) return;
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) return;
+  int src_w = resolution[s->status.framesize].width / 2;
+  int src_h = resolution[s->status.framesize].height / 2;
+  if ((size_t)src_w * src_h * 2 > preview_rgb_cap) return;
+
+  if (!jpg2rgb565(jpg, len, preview_rgb, JPG_SCALE_2X)) {
+    return;
+  }
+
+  // Crop is configured in captured-frame pixels; the decoded plane is at
+  // half scale, so halve and clamp into it
+  int cx = analytics_crop_x / 2;
+  int cy = analytics_crop_y / 2;
+  int cw = analytics_crop_w / 2;
+  int ch = analytics_crop_h / 2;
+  if (cw <= 0 || ch <= 0 || cx >= src_w || cy >= src_h) {
+    cx = cy = 0;
+    cw = src_w;
+    ch = src_h;
+  } else {
+    if (cx + cw > src_w) cw = src_w - cx;
+    if (cy + ch > src_h) ch = src_h - cy;
+  }
+
+  int dst_w = analytics_width;
+  int dst_h = analytics_height;
+  if (dst_w < 16 || dst_h < 16 ||
+      dst_w > ANALYTICS_MAX_W || dst_h > ANALYTICS_MAX_H) {
+    return;
+  }
+
+  // 16.16 fixed-point steps; integer-only inner loop over uint16_t pixels
+  uint32_t x_step = ((uint32_t)cw << 16) / dst_w;
+  uint32_t y_step = ((uint32_t)ch << 16) / dst_h;
+  const uint16_t *src = (const uint16_t *)preview_rgb;
+  uint16_t *dst = (uint16_t *)analytics_rgb;
+  uint32_t sy = 0;
+  for (int y = 0; y < dst_h; y++, sy += y_step) {
+    const uint16_t *row = src + (size_t)(cy + (sy >> 16)) * src_w + cx;
+    uint32_t sx = 0;
+    for (int x = 0; x < dst_w; x++, sx += x_step) {
+      *dst++ = row[sx >> 16];
+    }
+  }
+
+  analytics_pool.len = 0;
+  analytics_pool.overflow = false;
+  if (!fmt2jpg_cb(analytics_rgb, (size_t)dst_w * dst_h * 2, dst_w, dst_h,
+                  PIXFORMAT_RGB565, 80, jpg_pool_write, &analytics_pool) ||
+      analytics_pool.overflow) {
+    return;
+  }
+  publish_frame(FRAME_VARIANT_ANALYTICS, analytics_pool.buf,
+                analytics_pool.len, timestamp_us);
+}
+
+static void capture_task(void *arg) {
+  Serial.printf("Capture task running on core %d\n", xPortGetCoreID());
+  bool parked = false;
+
+  while (true) {
+    // Park once nobody has streamed for the idle timeout: no sensor
+    // reads, no JPEG work, no ring traffic. Between client drops inside
+    // the timeout the pipeline stays hot, so reconnects resume instantly.
+    // RTP consumers and the SD recorder don't register in
+    // metric_stream_clients, so each keeps the pipeline awake explicitly
+    // - recording exists precisely for the no-HTTP-clients case.
+    if (idle_timeout_s > 0 && metric_stream_clients == 0 &&
+        !rtp_stream_active() && !sd_recorder_active() &&
+        esp_timer_get_time() - last_active_us >
+            (int64_t)idle_timeout_s * 1000000) {
+      if (!parked) {
+        parked = true;
+        Serial.printf("No clients for %ds - capture pipeline parked\n",
+                      idle_timeout_s);
+      }
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    if (parked) {
+      parked = false;
+      Serial.println("Client activity - capture pipeline resumed");
+    }
+
+    // When paired-device sync is on, fire on the shared ESP-NOW tick
+    espnow_sync_wait_tick(pdMS_TO_TICKS(200));
+
+    int64_t t0 = esp_timer_get_time();
+    camera_fb_t *fb = esp_camera_fb_get();
+    metric_hist_record(&metric_capture_us, (uint32_t)(esp_timer_get_time() - t0));
+    if (!fb) {
+      Serial.println("Camera capture failed");
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    int64_t ts_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+
+    if (fb->format == PIXFORMAT_JPEG) {
+      publish_frame(FRAME_VARIANT_FULL, fb->buf, fb->len, ts_us);
+      if (preview_clients > 0) {
+        make_preview(fb->buf, fb->len, ts_us);
+      }
+      if (analytics_clients > 0) {
+        make_analytics(fb->buf, fb->len, ts_us);
+      }
+      esp_camera_fb_return(fb);
+    } else {
+      // Encode into the preallocated pool buffer - no per-frame malloc
+      conv_pool.len = 0;
+      conv_pool.overflow = false;
+      bool converted = frame2jpg_cb(fb, 80, jpg_pool_write, &conv_pool);
+      esp_camera_fb_return(fb);
+      if (converted && !conv_pool.overflow) {
+        publish_frame(FRAME_VARIANT_FULL, conv_pool.buf, conv_pool.len, ts_us);
+        if (preview_clients > 0) {
+          make_preview(conv_pool.buf, conv_pool.len, ts_us);
+        }
+        if (analytics_clients > 0) {
+          make_analytics(conv_pool.buf, conv_pool.len, ts_us);
+        }
+      } else {
+        Serial.println("JPEG compression failed");
+      }
+    }
+  }
+}
+
+bool frame_broadcast_start() {
+  memset(rings, 0, sizeof(rings));
+  ring_mutex = xSemaphoreCreateMutex();
+  if (!ring_mutex) {
+    Serial.println("Failed to create frame ring mutex");
+    return false;
+  }
+
+  // Preallocate every buffer the stream loop will ever need, from PSRAM
+  // when present, so steady-state operation is allocation-free
+  size_t slot_cap = psramFound() ? FRAME_SLOT_CAP_PSRAM : FRAME_SLOT_CAP_INTERNAL;
+  for (int v = 0; v < FRAME_VARIANT_COUNT; v++) {
+    size_t cap = slot_cap;
+    if (v == FRAME_VARIANT_PREVIEW && psramFound()) cap = FRAME_SLOT_CAP_PREVIEW;
+    if (v == FRAME_VARIANT_ANALYTICS) cap = FRAME_SLOT_CAP_ANALYTICS;
+    for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+      rings[v].slots[i].buf = pool_alloc(cap);
+      if (!rings[v].slots[i].buf) {
+        Serial.println("Failed to allocate frame ring slots");
+        return false;
+      }
+      rings[v].slots[i].cap = cap;
+    }
+  }
+  conv_pool.buf = pool_alloc(slot_cap);
+  if (!conv_pool.buf) {
+    Serial.println("Failed to allocate conversion buffer");
+    return false;
+  }
+  conv_pool.cap = slot_cap;
+
+  // Preview pipeline scratch lives in PSRAM only; without it the preview
+  // variant is simply never produced
+  if (psramFound()) {
+    preview_rgb_cap = 800 * 600 * 2;  // UXGA at 1/2 scale, RGB565
+    preview_rgb = (uint8_t *)ps_malloc(preview_rgb_cap);
+    preview_pool.buf = pool_alloc(FRAME_SLOT_CAP_PREVIEW);
+    preview_pool.cap = FRAME_SLOT_CAP_PREVIEW;
+    if (!preview_rgb || !preview_pool.buf) {
+      Serial.println("Preview buffers unavailable, preview profile disabled");
+      preview_rgb = NULL;
+    }
+    // Analytics output scratch; rides on the same half-scale decode plane
+    analytics_rgb = (uint8_t *)ps_malloc(ANALYTICS_MAX_W * ANALYTICS_MAX_H * 2);
+    analytics_pool.buf = pool_alloc(FRAME_SLOT_CAP_ANALYTICS);
+    analytics_pool.cap = FRAME_SLOT_CAP_ANALYTICS;
+    if (!analytics_rgb || !analytics_pool.buf) {
+      Serial.println("Analytics buffers unavailable, analytics profile disabled");
+      analytics_rgb = NULL;
+    }
+  }
+
+  Serial.printf("Frame rings: %d x %d slots x %u KB (%s)\n",
+                FRAME_VARIANT_COUNT, FRAME_RING_SLOTS,
+                (unsigned)(slot_cap / 1024), psramFound() ? "PSRAM" : "internal");
+  // Start the idle clock now so the pipeline is warm when the first
+  // client arrives
+  last_active_us = esp_timer_get_time();
+  // Pin to PRO_CPU (core 0); the Arduino loop and httpd tasks live on core 1
+  if (xTaskCreatePinnedToCore(capture_task, "cam_capture", 4096, NULL, 7,
+                              &capture_task_handle, 0) != pdPASS) {
+    Serial.println("Failed to start capture task");
+    return false;
+  }
+  return true;
+}
+
+void frame_cursor_init(frame_cursor_t *cur) {
+  frame_cursor_init_variant(cur, FRAME_VARIANT_FULL);
+}
+
+void frame_cursor_init_variant(frame_cursor_t *cur, frame_variant_t variant) {
+  // Start at the current head so a new client gets the next fresh frame
+  cur->last_seq = rings[variant].latest_seq;
+  cur->dropped = 0;
+}
+
+frame_slot_t *frame_broadcast_acquire(frame_cursor_t *cur, frame_mode_t mode,
+                                      TickType_t timeout) {
+  return frame_broadcast_acquire_variant(cur, mode, FRAME_VARIANT_FULL, timeout);
+}
+
+frame_slot_t *frame_broadcast_acquire_variant(frame_cursor_t *cur,
+                                              frame_mode_t mode,
+                                              frame_variant_t variant,
+                                              TickType_t timeout) {
+  TickType_t deadline = xTaskGetTickCount() + timeout;
+  frame_ring_t *r = &rings[variant];
+
+  while (true) {
+    xSemaphoreTake(ring_mutex, portMAX_DELAY);
+
+    // SEQUENTIAL: oldest frame this client hasn't seen yet.
+    // LATEST: newest published frame, skipping anything in between.
+    frame_slot_t *pick = NULL;
+    for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+      if (r->slots[i].seq <= cur->last_seq) continue;
+      if (!pick) {
+        pick = &r->slots[i];
+      } else if (mode == FRAME_MODE_LATEST ? r->slots[i].seq > pick->seq
+                                           : r->slots[i].seq < pick->seq) {
+        pick = &r->slots[i];
+      }
+    }
+
+    if (pick) {
+      pick->refs++;
+      cur->dropped += pick->seq - cur->last_seq - 1;
+      cur->last_seq = pick->seq;
+      xSemaphoreGive(ring_mutex);
+      return pick;
+    }
+
+    xSemaphoreGive(ring_mutex);
+
+    if (xTaskGetTickCount() >= deadline) {
+      return NULL;
+    }
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+}
+
+frame_slot_t *frame_broadcast_peek_latest() {
+  frame_slot_t *pick = NULL;
+  frame_ring_t *r = &rings[FRAME_VARIANT_FULL];
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+    if (r->slots[i].seq == 0) continue;
+    if (!pick || r->slots[i].seq > pick->seq) pick = &r->slots[i];
+  }
+  if (pick) pick->refs++;
+  xSemaphoreGive(ring_mutex);
+  return pick;
+}
+
+void frame_broadcast_release(frame_slot_t *slot) {
+  if (!slot) return;
+  xSemaphoreTake(ring_mutex, portMAX_DELAY);
+  if (slot->refs > 0) slot->refs--;
+  xSemaphoreGive(ring_mutex);
+}
+
+uint32_t frame_broadcast_latest_seq() {
+  return rings[FRAME_VARIANT_FULL].latest_seq;
+}
+
+bool frame_broadcast_preview_ready() {
+  return preview_rgb != NULL;
+}
+
+// Analytics shares the preview's half-scale decode plane
+bool frame_broadcast_analytics_ready() {
+  return preview_rgb != NULL && analytics_rgb != NULL;
+}
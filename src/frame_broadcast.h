@@ -0,0 +1,144 @@
+/*********
+  Frame broadcaster for the ESP32-CAM streaming server
+
+  One capture loop publishes JPEG frames into a shared ring of slots;
+  each connected client holds its own cursor into the ring. Adding a
+  viewer costs WiFi bandwidth only - the camera and JPEG pipeline run
+  exactly once per frame no matter how many clients are attached.
+*********/
+
+#ifndef FRAME_BROADCAST_H
+#define FRAME_BROADCAST_H
+
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+// Number of published frames kept in the ring. Small on purpose: clients
+// that fall further behind than this simply skip ahead.
+#define FRAME_RING_SLOTS 4
+
+// One published frame. buf/len are valid while the slot is held (refs > 0);
+// the capture loop never overwrites a slot a client is still sending.
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint32_t seq;          // monotonically increasing frame number, 0 = empty
+  int64_t timestamp_us;  // sensor timestamp from camera_fb_t
+  uint32_t sync_tick;    // ESP-NOW capture tick, 0 when sync is off
+  int refs;              // clients currently sending this slot
+} frame_slot_t;
+
+// Per-client read position into the ring
+typedef struct {
+  uint32_t last_seq;  // last frame sequence this client consumed
+  uint32_t dropped;   // frames published but never seen by this client
+} frame_cursor_t;
+
+// Which published variant a client consumes:
+//  - FULL is the sensor frame as captured
+//  - PREVIEW is a half-scale re-encode generated on-device, produced only
+//    while at least one preview client is attached (see preview_clients)
+//  - ANALYTICS is an on-device crop + fixed-point downscale to a small
+//    configurable size (160x120 by default), for vision clients that
+//    would otherwise pull full frames only to shrink them after decode
+typedef enum {
+  FRAME_VARIANT_FULL,
+  FRAME_VARIANT_PREVIEW,
+  FRAME_VARIANT_ANALYTICS,
+} frame_variant_t;
+
+#define FRAME_VARIANT_COUNT 3
+
+// How a client walks the ring:
+//  - SEQUENTIAL delivers every published frame in order (completeness)
+//  - LATEST always jumps to the newest frame, dropping whatever the
+//    client couldn't keep up with (freshness; real-time vision clients)
+typedef enum {
+  FRAME_MODE_SEQUENTIAL,
+  FRAME_MODE_LATEST,
+} frame_mode_t;
+
+// Allocate the ring and start the capture task (pinned to PRO_CPU).
+// Call once from setup() after esp_camera_init() succeeds.
+bool frame_broadcast_start();
+
+void frame_cursor_init(frame_cursor_t *cur);
+
+// Cursor for a specific variant's ring (sequence numbers are per-ring)
+void frame_cursor_init_variant(frame_cursor_t *cur, frame_variant_t variant);
+
+// Block until a frame newer than the cursor is available, take a reference
+// on its slot and advance the cursor. In LATEST mode skipped frames are
+// added to the cursor's dropped counter. Returns NULL on timeout.
+frame_slot_t *frame_broadcast_acquire(frame_cursor_t *cur, frame_mode_t mode,
+                                      TickType_t timeout);
+
+// Same, but selecting which published variant to read
+frame_slot_t *frame_broadcast_acquire_variant(frame_cursor_t *cur,
+                                              frame_mode_t mode,
+                                              frame_variant_t variant,
+                                              TickType_t timeout);
+
+// Number of attached preview-profile clients; the capture loop only pays
+// for the decode/re-encode while this is non-zero (dispatcher maintains it)
+extern volatile int preview_clients;
+
+// Same for analytics-profile clients
+extern volatile int analytics_clients;
+
+// Whether the preview/analytics scratch buffers were actually allocated.
+// Profile parsing must check these, not just psramFound(): a client
+// attached to a variant ring that never publishes would hang forever.
+bool frame_broadcast_preview_ready();
+bool frame_broadcast_analytics_ready();
+
+// Analytics variant geometry, adjustable via /control. The crop rectangle
+// is given in captured-frame pixels (the frame /capture returns); a zero
+// crop width or height means the whole frame. Output dimensions are
+// capped at 320x240 by the scratch buffer.
+extern volatile int analytics_width;    // output width, default 160
+extern volatile int analytics_height;   // output height, default 120
+extern volatile int analytics_crop_x;
+extern volatile int analytics_crop_y;
+extern volatile int analytics_crop_w;   // 0 = full frame
+extern volatile int analytics_crop_h;
+
+// Take a reference on the most recently published frame without waiting
+// for a new one. Returns NULL if nothing has been published yet.
+frame_slot_t *frame_broadcast_peek_latest();
+
+// Drop the reference taken by frame_broadcast_acquire()/peek_latest()
+void frame_broadcast_release(frame_slot_t *slot);
+
+// Sequence number of the most recently published frame
+uint32_t frame_broadcast_latest_seq();
+
+// Motion-gated publishing: when enabled and the scene is static, frames
+// are published at only motion_keepalive_fps instead of full rate, and
+// burst back to full rate as soon as change is detected. The detector
+// works on coarse block sums of the compressed JPEG bytes (the sensor
+// delivers JPEG directly, so no raw luminance plane is available).
+extern volatile bool motion_gate_enabled;
+extern volatile int motion_keepalive_fps;   // publish rate while static
+extern volatile int motion_threshold;       // per-mille block change to count as motion
+
+// Idle power-down: the pipeline keeps running between client drops, so a
+// reconnecting viewer gets its first frame within one frame interval.
+// Once no client has been attached for idle_timeout_s seconds the capture
+// loop parks (no sensor reads, no JPEG work) until the next client
+// activity. 0 keeps it hot forever.
+extern volatile int idle_timeout_s;
+
+// Record client activity: resets the idle timer and resumes a parked
+// pipeline. Called by the dispatcher on connect and by /capture.
+void frame_broadcast_touch();
+
+// Adaptive quality: when a bandwidth budget is set (kbit/s, 0 disables),
+// a once-per-second controller nudges the sensor's JPEG quality so the
+// published byte rate holds the budget regardless of scene content
+extern volatile int bandwidth_budget_kbps;
+
+#endif  // FRAME_BROADCAST_H
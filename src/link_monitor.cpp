@@ -0,0 +1,99 @@
+#include "link_monitor.h"
+
+#include <WiFi.h>
+
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stream_dispatch.h"
+#include "metrics.h"
+#include "sensor_lock.h"
+
+#define LINK_SAMPLE_MS 2000
+#define LINK_RESTORE_SAMPLES 3  // consecutive good samples before restoring
+
+volatile bool link_adapt_enabled = true;
+
+static volatile int last_rssi = 0;
+static TaskHandle_t monitor_task_handle = NULL;
+
+// Saved pre-degradation settings
+static bool degraded = false;
+static int baseline_fps = 0;
+static int baseline_quality = 0;
+static int good_samples = 0;
+
+static void degrade_link() {
+  sensor_t *s = esp_camera_sensor_get();
+  baseline_fps = stream_target_fps;
+
+  int reduced = stream_target_fps / 2;
+  stream_target_fps = reduced < 5 ? 5 : reduced;
+  sensor_lock();
+  baseline_quality = s ? s->status.quality : 0;
+  if (s && s->status.quality < 36) {
+    s->set_quality(s, s->status.quality + 4);  // more compression
+  }
+  sensor_unlock();
+  degraded = true;
+  Serial.printf("Link degraded (%d dBm): fps %d -> %d, quality stepped\n",
+                last_rssi, baseline_fps, stream_target_fps);
+}
+
+static void restore_link() {
+  sensor_t *s = esp_camera_sensor_get();
+  stream_target_fps = baseline_fps;
+  if (s && baseline_quality > 0) {
+    sensor_lock();
+    s->set_quality(s, baseline_quality);
+    sensor_unlock();
+  }
+  degraded = false;
+  good_samples = 0;
+  Serial.printf("Link recovered (%d dBm): fps restored to %d\n",
+                last_rssi, stream_target_fps);
+}
+
+static void monitor_task(void *arg) {
+  while (true) {
+    vTaskDelay(pdMS_TO_TICKS(LINK_SAMPLE_MS));
+
+    if (WiFi.status() != WL_CONNECTED) {
+      last_rssi = 0;
+      continue;
+    }
+
+    last_rssi = WiFi.RSSI();
+    metric_wifi_rssi = last_rssi;
+
+    if (!link_adapt_enabled) {
+      continue;
+    }
+
+    if (!degraded && last_rssi < LINK_RSSI_DEGRADE) {
+      degrade_link();
+    } else if (degraded) {
+      if (last_rssi > LINK_RSSI_RESTORE) {
+        if (++good_samples >= LINK_RESTORE_SAMPLES) {
+          restore_link();
+        }
+      } else {
+        good_samples = 0;
+      }
+    }
+  }
+}
+
+bool link_monitor_start() {
+  if (xTaskCreatePinnedToCore(monitor_task, "link_monitor", 3072, NULL, 3,
+                              &monitor_task_handle, 1) != pdPASS) {
+    Serial.println("Failed to start link monitor");
+    return false;
+  }
+  return true;
+}
+
+int link_monitor_rssi() {
+  return last_rssi;
+}
@@ -0,0 +1,28 @@
+/*********
+  WiFi link monitor for the ESP32-CAM streaming server
+
+  FPS cliffs track WiFi degradation, but the send path only notices
+  once TCP already stalls. A background task samples RSSI, publishes it
+  through metrics and the status page, and - when adaptation is enabled
+  - proactively halves the frame rate and steps up JPEG compression as
+  the link weakens, restoring the originals once it recovers.
+*********/
+
+#ifndef LINK_MONITOR_H
+#define LINK_MONITOR_H
+
+// RSSI thresholds with hysteresis: degrade below -75 dBm, restore only
+// after the link has held above -70 dBm for several samples
+#define LINK_RSSI_DEGRADE  -75
+#define LINK_RSSI_RESTORE  -70
+
+// Start the sampling task; call after WiFi is connected
+bool link_monitor_start();
+
+// Rate adaptation on/off (on by default; /control?var=link_adapt)
+extern volatile bool link_adapt_enabled;
+
+// Most recent RSSI sample in dBm (0 until the first sample)
+int link_monitor_rssi();
+
+#endif  // LINK_MONITOR_H
@@ -23,13 +23,25 @@
 #include "soc/soc.h" //disable brownout problems
 #include "soc/rtc_cntl_reg.h"  //disable brownout problems
 #include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frame_broadcast.h"
+#include "stream_dispatch.h"
+#include "metrics.h"
+#include "replay_ring.h"
+#include "rtp_stream.h"
+#include "bench_mode.h"
+#include "espnow_sync.h"
+#include "link_monitor.h"
+#include "sd_recorder.h"
+#include "ota_update.h"
+#include "sensor_lock.h"
+#include "fast_boot.h"
 #include "wifi_config.h"  // Local WiFi configuration
 
 // Device identifier (change for second device)
 const char* device_name = "ESP32_CAM_1";  // Change to "ESP32_CAM_2" for second device
 
-#define PART_BOUNDARY "123456789000000000000987654321"
-
 // Camera model selection
 #define CAMERA_MODEL_AI_THINKER
 //#define CAMERA_MODEL_M5STACK_PSRAM
@@ -57,137 +69,446 @@ const char* device_name = "ESP32_CAM_1";  // Change to "ESP32_CAM_2" for second
   #error "Camera model not selected"
 #endif
 
-static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
-
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
-// Enhanced stream handler with better OpenCV compatibility
+// Stream handlers are thin: they pick the wire protocol and cursor mode,
+// then hand the connection to the shared dispatcher task. The httpd
+// worker returns immediately instead of camping on the request forever.
+
+// ?mode=all restores every-frame delivery; the default always ships the
+// newest frame and drops what a slow client missed
+static frame_mode_t stream_mode_from_query(httpd_req_t *req) {
+  char query[64];
+  char value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "mode", value, sizeof(value)) == ESP_OK &&
+      strcmp(value, "all") == 0) {
+    return FRAME_MODE_SEQUENTIAL;
+  }
+  return FRAME_MODE_LATEST;
+}
+
+// Named stream profiles: ?profile=record serves the full-resolution
+// variant capped at 5 FPS (NVR-style consumers); ?profile=preview serves
+// the on-device half-scale re-encode at full rate; ?profile=analytics
+// serves the cropped/downscaled feed (160x120 by default, see the
+// analytics_* control variables). Default is the full variant at the
+// shared target FPS.
+#define RECORD_PROFILE_FPS 5
+
+static void stream_profile_from_query(httpd_req_t *req,
+                                      frame_variant_t *variant, int *fps) {
+  *variant = FRAME_VARIANT_FULL;
+  *fps = 0;
+  char query[64];
+  char value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "profile", value, sizeof(value)) != ESP_OK) {
+    return;
+  }
+  if (strcmp(value, "record") == 0) {
+    *fps = RECORD_PROFILE_FPS;
+  } else if (strcmp(value, "preview") == 0 && frame_broadcast_preview_ready()) {
+    *variant = FRAME_VARIANT_PREVIEW;
+  } else if (strcmp(value, "analytics") == 0 && frame_broadcast_analytics_ready()) {
+    *variant = FRAME_VARIANT_ANALYTICS;
+  }
+}
+
+// QoS tier: ?prio=high marks a latency-critical consumer (the OpenCV
+// tracker); everything else is best effort
+static stream_prio_t stream_prio_from_query(httpd_req_t *req){
+  char query[64];
+  char value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "prio", value, sizeof(value)) == ESP_OK &&
+      strcmp(value, "high") == 0) {
+    return STREAM_PRIO_HIGH;
+  }
+  return STREAM_PRIO_LOW;
+}
+
 static esp_err_t stream_handler(httpd_req_t *req){
-  camera_fb_t * fb = NULL;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t * _jpg_buf = NULL;
-  char * part_buf[128];
-  
-  Serial.println("Stream client connected");
+  frame_variant_t variant;
+  int fps;
+  stream_profile_from_query(req, &variant, &fps);
+  return stream_dispatch_add(req, STREAM_PROTO_MJPEG, stream_mode_from_query(req),
+                             variant, fps, stream_prio_from_query(req));
+}
 
-  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-  if(res != ESP_OK){
-    return res;
+static esp_err_t stream_bin_handler(httpd_req_t *req){
+  frame_variant_t variant;
+  int fps;
+  stream_profile_from_query(req, &variant, &fps);
+  return stream_dispatch_add(req, STREAM_PROTO_BIN, stream_mode_from_query(req),
+                             variant, fps, stream_prio_from_query(req));
+}
+
+// Single-JPEG snapshot handler: returns the most recent frame already
+// sitting in the broadcast ring, so a fresh shot is one HTTP round trip
+// with no stream setup or multipart parsing on the client side
+static esp_err_t capture_handler(httpd_req_t *req){
+  frame_broadcast_touch();  // a parked pipeline resumes for the snapshot
+  frame_slot_t *slot = frame_broadcast_peek_latest();
+
+  // After an idle park the newest slot can be minutes old - don't serve
+  // it as a fresh shot. Anything older than two frame intervals falls
+  // through to waiting for a new publish (the touch above already woke
+  // the pipeline, so one arrives within the acquire timeout).
+  if (slot) {
+    int fps = stream_target_fps > 0 ? stream_target_fps : 1;
+    if (esp_timer_get_time() - slot->timestamp_us > 2 * 1000000 / fps) {
+      frame_broadcast_release(slot);
+      slot = NULL;
+    }
+  }
+  if (!slot) {
+    frame_cursor_t cursor;
+    frame_cursor_init(&cursor);
+    slot = frame_broadcast_acquire(&cursor, FRAME_MODE_LATEST, pdMS_TO_TICKS(1000));
+  }
+  if (!slot) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No frame available");
+    return ESP_FAIL;
   }
 
-  // Add CORS headers for better compatibility
+  httpd_resp_set_type(req, "image/jpeg");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_hdr(req, "Cache-Control", "no-cache, no-store, must-revalidate");
-  
-  uint32_t frame_count = 0;
-  unsigned long last_frame_time = millis();
-  
-  while(true){
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      Serial.println("Camera capture failed");
-      res = ESP_FAIL;
-      break;
-    } else {
-      frame_count++;
-      
-      // Process all frames, not just width > 400
-      if(fb->format != PIXFORMAT_JPEG){
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-        esp_camera_fb_return(fb);
-        fb = NULL;
-        if(!jpeg_converted){
-          Serial.println("JPEG compression failed");
-          res = ESP_FAIL;
-        }
-      } else {
-        _jpg_buf_len = fb->len;
-        _jpg_buf = fb->buf;
-      }
-    }
-    
-    if(res == ESP_OK){
-      size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len);
-      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-    }
-    if(res == ESP_OK){
-      res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
+  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+  esp_err_t res = httpd_resp_send(req, (const char *)slot->buf, slot->len);
+
+  frame_broadcast_release(slot);
+  return res;
+}
+
+// WebSocket stream endpoint with client-side backpressure: the server
+// pushes binary JPEG frames only while the client holds credit, and
+// every message from the client grants more (its ASCII integer value,
+// or 1 for anything unparseable). A browser that ACKs per frame drawn
+// therefore never accumulates a buffer of stale frames.
+static esp_err_t ws_handler(httpd_req_t *req){
+  if (req->method == HTTP_GET) {
+    // Handshake just completed - hand the socket to the dispatcher
+    return stream_dispatch_add_ws(req);
+  }
+
+  httpd_ws_frame_t frame;
+  uint8_t payload[16];
+  memset(&frame, 0, sizeof(frame));
+  if (httpd_ws_recv_frame(req, &frame, 0) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (frame.len >= sizeof(payload)) {
+    return ESP_FAIL;  // credit messages are tiny; anything else is bogus
+  }
+  int credits = 1;
+  if (frame.len > 0) {
+    frame.payload = payload;
+    if (httpd_ws_recv_frame(req, &frame, frame.len) != ESP_OK) {
+      return ESP_FAIL;
     }
-    if(res == ESP_OK){
-      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+    payload[frame.len] = '\0';
+    int parsed = atoi((const char *)payload);
+    if (parsed > 0 && parsed <= 30) credits = parsed;
+  }
+
+  stream_dispatch_ws_credit(httpd_req_to_sockfd(req), credits);
+  return ESP_OK;
+}
+
+// Region-of-interest capture: /roi?x=<px>&y=<px>&w=<px>&h=<px> programs a
+// sensor window in full-array (UXGA, 1600x1200) coordinates, so capture,
+// JPEG encode and WiFi all shrink to just the region. /roi?reset=1
+// returns to the configured full framesize.
+static esp_err_t roi_handler(httpd_req_t *req){
+  char query[96];
+  char value[16];
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Sensor not available");
+    return ESP_FAIL;
+  }
+  if (s->id.PID != OV2640_PID) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "ROI requires OV2640");
+    return ESP_FAIL;
+  }
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected ?x=&y=&w=&h= or ?reset=1");
+    return ESP_FAIL;
+  }
+
+  if (httpd_query_key_value(query, "reset", value, sizeof(value)) == ESP_OK) {
+    sensor_lock();
+    s->set_framesize(s, (framesize_t)s->status.framesize);
+    sensor_unlock();
+    Serial.println("ROI reset to full frame");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_sendstr(req, "OK");
+  }
+
+  int x = -1, y = -1, w = -1, h = -1;
+  if (httpd_query_key_value(query, "x", value, sizeof(value)) == ESP_OK) x = atoi(value);
+  if (httpd_query_key_value(query, "y", value, sizeof(value)) == ESP_OK) y = atoi(value);
+  if (httpd_query_key_value(query, "w", value, sizeof(value)) == ESP_OK) w = atoi(value);
+  if (httpd_query_key_value(query, "h", value, sizeof(value)) == ESP_OK) h = atoi(value);
+
+  // The OV2640 window logic needs 4-aligned offsets and sizes inside the
+  // full sensor array
+  if (x < 0 || y < 0 || w < 96 || h < 96 ||
+      x + w > 1600 || y + h > 1200 ||
+      (x % 4) || (y % 4) || (w % 4) || (h % 4)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "Window must be 4-aligned, >=96px and inside 1600x1200");
+    return ESP_FAIL;
+  }
+
+  // startX selects the full-array readout mode on the OV2640; the window
+  // is (x, y, w, h) with 1:1 output (no scaling, no binning)
+  sensor_lock();
+  int win_res = s->set_res_raw(s, 0, 0, 0, 0, x, y, w, h, w, h, false, false);
+  sensor_unlock();
+  if (win_res != 0) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Sensor rejected window");
+    return ESP_FAIL;
+  }
+
+  Serial.printf("ROI window: %dx%d at (%d,%d)\n", w, h, x, y);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_sendstr(req, "OK");
+}
+
+// Runtime camera control: /control?var=framesize&val=5 etc. applies
+// changes through the live sensor handle, so clients can trade
+// resolution for FPS mid-session without a reflash or power cycle
+static esp_err_t control_handler(httpd_req_t *req){
+  char query[96];
+  char var[24];
+  char val[16];
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "var", var, sizeof(var)) != ESP_OK ||
+      httpd_query_key_value(query, "val", val, sizeof(val)) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected ?var=<name>&val=<value>");
+    return ESP_FAIL;
+  }
+
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Sensor not available");
+    return ESP_FAIL;
+  }
+
+  int v = atoi(val);
+  int res = 0;
+  if (!strcmp(var, "framesize")) {
+    // FRAMESIZE_96X96 .. FRAMESIZE_UXGA; bigger sizes need PSRAM
+    if (v < 0 || v > FRAMESIZE_UXGA || (!psramFound() && v > FRAMESIZE_VGA)) {
+      res = -1;
+    } else {
+      sensor_lock();
+      res = s->set_framesize(s, (framesize_t)v);
+      sensor_unlock();
     }
-    
-    if(fb){
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      _jpg_buf = NULL;
-    } else if(_jpg_buf){
-      free(_jpg_buf);
-      _jpg_buf = NULL;
+  } else if (!strcmp(var, "quality")) {
+    if (v >= 4 && v <= 63) {
+      sensor_lock();
+      res = s->set_quality(s, v);
+      sensor_unlock();
+    } else {
+      res = -1;
     }
-    
-    if(res != ESP_OK){
-      Serial.println("Stream client disconnected");
-      break;
+  } else if (!strcmp(var, "fps")) {
+    if (v >= 1 && v <= 60) {
+      stream_target_fps = v;
+    } else {
+      res = -1;
     }
-    
-    // Log frame rate every 100 frames
-    if(frame_count % 100 == 0) {
-      unsigned long current_time = millis();
-      float fps = 100000.0 / (current_time - last_frame_time);
-      Serial.printf("Frames: %u, FPS: %.1f\n", frame_count, fps);
-      last_frame_time = current_time;
+  } else if (!strcmp(var, "motion")) {
+    motion_gate_enabled = (v != 0);
+  } else if (!strcmp(var, "keepalive_fps")) {
+    res = (v >= 1 && v <= 30) ? (motion_keepalive_fps = v, 0) : -1;
+  } else if (!strcmp(var, "motion_threshold")) {
+    res = (v >= 1 && v <= 500) ? (motion_threshold = v, 0) : -1;
+  } else if (!strcmp(var, "budget_kbps")) {
+    res = (v >= 0 && v <= 20000) ? (bandwidth_budget_kbps = v, 0) : -1;
+  } else if (!strcmp(var, "sync")) {
+    sync_enabled = (v != 0);
+  } else if (!strcmp(var, "link_adapt")) {
+    link_adapt_enabled = (v != 0);
+  } else if (!strcmp(var, "ota_max_wait")) {
+    res = (v >= 0 && v <= 86400) ? (ota_reboot_max_s = v, 0) : -1;
+  } else if (!strcmp(var, "record")) {
+    record_enabled = (v != 0);
+  } else if (!strcmp(var, "record_fps")) {
+    res = (v >= 1 && v <= 30) ? (record_fps = v, 0) : -1;
+  } else if (!strcmp(var, "idle_timeout")) {
+    res = (v >= 0 && v <= 3600) ? (idle_timeout_s = v, 0) : -1;  // 0 = never park
+  } else if (!strcmp(var, "analytics_w")) {
+    res = (v >= 16 && v <= 320) ? (analytics_width = v, 0) : -1;
+  } else if (!strcmp(var, "analytics_h")) {
+    res = (v >= 16 && v <= 240) ? (analytics_height = v, 0) : -1;
+  } else if (!strcmp(var, "acrop_x")) {
+    res = (v >= 0) ? (analytics_crop_x = v, 0) : -1;
+  } else if (!strcmp(var, "acrop_y")) {
+    res = (v >= 0) ? (analytics_crop_y = v, 0) : -1;
+  } else if (!strcmp(var, "acrop_w")) {
+    res = (v >= 0) ? (analytics_crop_w = v, 0) : -1;  // 0 = full frame
+  } else if (!strcmp(var, "acrop_h")) {
+    res = (v >= 0) ? (analytics_crop_h = v, 0) : -1;
+  } else {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown variable");
+    return ESP_FAIL;
+  }
+
+  if (res != 0) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Value rejected");
+    return ESP_FAIL;
+  }
+
+  // Persist sensor changes so they survive a reboot
+  if (!strcmp(var, "framesize") || !strcmp(var, "quality")) {
+    fast_boot_camera_save(s->status.framesize, s->status.quality);
+  }
+
+  Serial.printf("Control: %s = %d\n", var, v);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_sendstr(req, "OK");
+}
+
+// Status page. The HTML skeleton is a compile-time template in flash;
+// per request we only patch the dynamic fields into a static buffer, so
+// a fleet dashboard polling / on many devices costs neither a 2 KB stack
+// frame on the httpd task nor a rebuild of the markup.
+static const char INDEX_TEMPLATE[] PROGMEM =
+  "<!DOCTYPE html>\n"
+  "<html><head><title>%s</title></head>\n"
+  "<body style='font-family: Arial;'>\n"
+  "<h2>%s Status</h2>\n"
+  "<p><strong>IP Address:</strong> %s</p>\n"
+  "<p><strong>MAC Address:</strong> %s</p>\n"
+  "<p><strong>Free Heap:</strong> %u bytes</p>\n"
+  "<p><strong>Uptime:</strong> %lu seconds</p>\n"
+  "<p><strong>WiFi RSSI:</strong> %d dBm</p>\n"
+  "<hr>\n"
+  "<h3>Stream URLs:</h3>\n"
+  "<p><a href='/stream'>MJPEG Stream</a> (for OpenCV)</p>\n"
+  "<p><a href='/capture'>Single JPEG capture</a></p>\n"
+  "<p><a href='/'>This page</a></p>\n"
+  "<hr>\n"
+  "<h3>Live Preview:</h3>\n"
+  "<img src='/stream' style='max-width: 640px; border: 1px solid #ccc;'>\n"
+  "</body></html>";
+
+// The ETag covers only the device's identity (name, IP, MAC), which is
+// stable for the life of a boot - liveness pollers that send
+// If-None-Match get a 304 with no page build at all. Heap and uptime
+// churn every request and deliberately stay outside the tag.
+static uint32_t index_etag() {
+  static uint32_t etag = 0;
+  if (etag == 0) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    String id = String(device_name) + WiFi.localIP().toString() + WiFi.macAddress();
+    for (size_t i = 0; i < id.length(); i++) {
+      h = (h ^ (uint8_t)id[i]) * 16777619u;
     }
-    
-    // Small delay to prevent overwhelming the client
-    delay(33); // ~30 FPS max
+    etag = h ? h : 1;
   }
-  
-  return res;
+  return etag;
 }
 
-// Simple status page handler
 static esp_err_t index_handler(httpd_req_t *req){
-  char html_page[2048];
-  
-  snprintf(html_page, sizeof(html_page),
-    "<!DOCTYPE html>\n"
-    "<html><head><title>%s</title></head>\n"
-    "<body style='font-family: Arial;'>\n"
-    "<h2>%s Status</h2>\n"
-    "<p><strong>IP Address:</strong> %s</p>\n"
-    "<p><strong>MAC Address:</strong> %s</p>\n"
-    "<p><strong>Free Heap:</strong> %u bytes</p>\n"
-    "<p><strong>Uptime:</strong> %lu seconds</p>\n"
-    "<hr>\n"
-    "<h3>Stream URLs:</h3>\n"
-    "<p><a href='/stream'>MJPEG Stream</a> (for OpenCV)</p>\n"
-    "<p><a href='/'>This page</a></p>\n"
-    "<hr>\n"
-    "<h3>Live Preview:</h3>\n"
-    "<img src='/stream' style='max-width: 640px; border: 1px solid #ccc;'>\n"
-    "</body></html>",
-    device_name, device_name, 
+  // httpd serves requests from one task, so a single static buffer is safe
+  static char html_page[2048];
+  char etag[16];
+  char if_none_match[16];
+
+  snprintf(etag, sizeof(etag), "\"%08x\"", index_etag());
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                  sizeof(if_none_match)) == ESP_OK &&
+      strcmp(if_none_match, etag) == 0) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  int len = snprintf(html_page, sizeof(html_page), INDEX_TEMPLATE,
+    device_name, device_name,
     WiFi.localIP().toString().c_str(),
     WiFi.macAddress().c_str(),
     ESP.getFreeHeap(),
-    millis() / 1000
+    millis() / 1000,
+    link_monitor_rssi()
   );
-  
+  if (len >= (int)sizeof(html_page)) len = sizeof(html_page) - 1;
+
   httpd_resp_set_type(req, "text/html");
-  return httpd_resp_send(req, html_page, strlen(html_page));
+  httpd_resp_set_hdr(req, "ETag", etag);
+  // httpd_resp_send emits Content-Length from the explicit length
+  return httpd_resp_send(req, html_page, len);
+}
+
+// Machine-readable status for fleet scraping. The JSON is serialized
+// once per second by the housekeeping path in loop() into one of two
+// buffers; the handler just sends whichever buffer was published last.
+// Forty devices polled at 1 Hz therefore cost each device one snprintf
+// per second regardless of how often /status.json is hit.
+static char status_buf[2][384];
+static size_t status_buf_len[2];
+static volatile int status_active = -1;  // -1 until the first refresh
+
+static void status_json_refresh() {
+  int idx = (status_active == 0) ? 1 : 0;
+
+  sensor_t *s = esp_camera_sensor_get();
+  int fs = s ? s->status.framesize : 0;
+  int quality = s ? s->status.quality : 0;
+
+  status_buf_len[idx] = snprintf(status_buf[idx], sizeof(status_buf[idx]),
+    "{\"device\":\"%s\",\"resolution\":\"%ux%u\",\"quality\":%d,"
+    "\"fps\":%d,\"clients\":%d,\"heap_free\":%u,\"heap_min\":%u,"
+    "\"rssi_dbm\":%d,\"uptime_s\":%lu}\n",
+    device_name,
+    resolution[fs].width, resolution[fs].height,
+    quality,
+    stream_target_fps,
+    metric_stream_clients,
+    ESP.getFreeHeap(),
+    ESP.getMinFreeHeap(),
+    link_monitor_rssi(),
+    millis() / 1000);
+
+  status_active = idx;  // publish; readers pick the buffer up atomically
+}
+
+static esp_err_t status_json_handler(httpd_req_t *req){
+  int idx = status_active;
+  if (idx < 0) {
+    // loop() hasn't produced the first snapshot yet (sub-second window
+    // right after boot)
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status not ready");
+    return ESP_FAIL;
+  }
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  return httpd_resp_send(req, status_buf[idx], status_buf_len[idx]);
 }
 
 void startCameraServer(){
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.server_port = 80;
-  config.max_uri_handlers = 10;
+  config.max_uri_handlers = 16;
   config.task_priority = 6;
   config.stack_size = 8192;
+  // Stream clients are parked as async requests; purge the least
+  // recently used session when the socket table fills up
+  config.lru_purge_enable = true;
+  // Reap stream client entries whenever their session dies, so viewers
+  // that vanish without a failed send can't pin dispatcher slots
+  config.close_fn = stream_dispatch_close_fn;
 
   // Main status page
   httpd_uri_t index_uri = {
@@ -204,11 +525,121 @@ void startCameraServer(){
     .handler   = stream_handler,
     .user_ctx  = NULL
   };
-  
+
+  // Single-frame snapshot endpoint
+  httpd_uri_t capture_uri = {
+    .uri       = "/capture",
+    .method    = HTTP_GET,
+    .handler   = capture_handler,
+    .user_ctx  = NULL
+  };
+
+  // Binary length-prefixed stream endpoint
+  httpd_uri_t stream_bin_uri = {
+    .uri       = "/stream.bin",
+    .method    = HTTP_GET,
+    .handler   = stream_bin_handler,
+    .user_ctx  = NULL
+  };
+
+  // Runtime sensor/stream control endpoint
+  httpd_uri_t control_uri = {
+    .uri       = "/control",
+    .method    = HTTP_GET,
+    .handler   = control_handler,
+    .user_ctx  = NULL
+  };
+
+  // Prometheus metrics endpoint
+  httpd_uri_t metrics_uri = {
+    .uri       = "/metrics",
+    .method    = HTTP_GET,
+    .handler   = metrics_handler,
+    .user_ctx  = NULL
+  };
+
+  // Replay of recently retained frames
+  httpd_uri_t replay_uri = {
+    .uri       = "/replay",
+    .method    = HTTP_GET,
+    .handler   = replay_handler,
+    .user_ctx  = NULL
+  };
+
+  // Sensor window (region of interest) control
+  httpd_uri_t roi_uri = {
+    .uri       = "/roi",
+    .method    = HTTP_GET,
+    .handler   = roi_handler,
+    .user_ctx  = NULL
+  };
+
+  // RTP/JPEG session control
+  httpd_uri_t rtp_uri = {
+    .uri       = "/rtp",
+    .method    = HTTP_GET,
+    .handler   = rtp_session_handler,
+    .user_ctx  = NULL
+  };
+
+  // WebSocket stream with credit-based flow control
+  httpd_uri_t ws_uri = {
+    .uri       = "/ws",
+    .method    = HTTP_GET,
+    .handler   = ws_handler,
+    .user_ctx  = NULL,
+    .is_websocket = true
+  };
+
+  // Firmware upload to the inactive app partition
+  httpd_uri_t ota_uri = {
+    .uri       = "/ota",
+    .method    = HTTP_POST,
+    .handler   = ota_handler,
+    .user_ctx  = NULL
+  };
+
+  // SD segment listing/download
+  httpd_uri_t recordings_uri = {
+    .uri       = "/recordings",
+    .method    = HTTP_GET,
+    .handler   = recordings_handler,
+    .user_ctx  = NULL
+  };
+
+  // Cached JSON status for fleet scraping
+  httpd_uri_t status_uri = {
+    .uri       = "/status.json",
+    .method    = HTTP_GET,
+    .handler   = status_json_handler,
+    .user_ctx  = NULL
+  };
+
+  // Benchmark report (404 unless a bench run has completed)
+  httpd_uri_t bench_uri = {
+    .uri       = "/bench.json",
+    .method    = HTTP_GET,
+    .handler   = bench_json_handler,
+    .user_ctx  = NULL
+  };
+
   Serial.printf("Starting web server on port: %d\n", config.server_port);
   if (httpd_start(&stream_httpd, &config) == ESP_OK) {
     httpd_register_uri_handler(stream_httpd, &index_uri);
     httpd_register_uri_handler(stream_httpd, &stream_uri);
+    httpd_register_uri_handler(stream_httpd, &stream_bin_uri);
+    httpd_register_uri_handler(stream_httpd, &capture_uri);
+    httpd_register_uri_handler(stream_httpd, &control_uri);
+    httpd_register_uri_handler(stream_httpd, &metrics_uri);
+    httpd_register_uri_handler(stream_httpd, &replay_uri);
+    httpd_register_uri_handler(stream_httpd, &roi_uri);
+    httpd_register_uri_handler(stream_httpd, &rtp_uri);
+    httpd_register_uri_handler(stream_httpd, &ws_uri);
+    httpd_register_uri_handler(stream_httpd, &ota_uri);
+    httpd_register_uri_handler(stream_httpd, &recordings_uri);
+    httpd_register_uri_handler(stream_httpd, &status_uri);
+    httpd_register_uri_handler(stream_httpd, &bench_uri);
+    stream_dispatch_start(stream_httpd);
     Serial.println("HTTP server started successfully");
   } else {
     Serial.println("Failed to start HTTP server");
@@ -266,10 +697,28 @@ void setup() {
   }
   
   Serial.println("Camera initialized successfully");
-  
+
+  // Sensor register writes come from several tasks from here on; they
+  // all serialize on this lock (OV2640 access is bank-switched)
+  sensor_lock_init();
+
+#ifdef BENCH_MODE
+  // Run the performance matrix before the streaming pipeline owns the
+  // sensor; results stay cached for /bench.json
+  bench_mode_run();
+#endif
+
+  // Start the shared capture loop now that the sensor is up
+  replay_ring_start();
+  frame_broadcast_start();
+
+  // Local footage on the SD slot; harmless no-op without a card
+  sd_recorder_start();
+
   // Get camera sensor for additional settings
   sensor_t * s = esp_camera_sensor_get();
   if (s) {
+    sensor_lock();
     // Optimize settings for streaming
     s->set_brightness(s, 0);     // -2 to 2
     s->set_contrast(s, 0);       // -2 to 2
@@ -293,29 +742,51 @@ void setup() {
     s->set_vflip(s, 0);          // 0 = disable , 1 = enable
     s->set_dcw(s, 1);            // 0 = disable , 1 = enable
     s->set_colorbar(s, 0);       // 0 = disable , 1 = enable
-    
+
+    // Reapply settings changed through /control before the last reboot
+    int saved_framesize, saved_quality;
+    if (fast_boot_camera_load(&saved_framesize, &saved_quality)) {
+      s->set_framesize(s, (framesize_t)saved_framesize);
+      s->set_quality(s, saved_quality);
+      Serial.printf("Restored camera settings: framesize=%d quality=%d\n",
+                    saved_framesize, saved_quality);
+    }
+    sensor_unlock();
+
     Serial.println("Camera sensor configured");
   }
-  
-  // Wi-Fi connection
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  Serial.print("Connecting to WiFi");
-  Serial.printf(" (%s)", WIFI_SSID);
-  
-  int wifi_attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && wifi_attempts < 30) {
-    delay(500);
-    Serial.print(".");
-    wifi_attempts++;
+
+  // Wi-Fi connection: try the cached-association fast path first, then
+  // fall back to a full scan with DHCP
+  if (!fast_boot_wifi_try(WIFI_SSID, WIFI_PASSWORD, 3000)) {
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    Serial.print("Connecting to WiFi");
+    Serial.printf(" (%s)", WIFI_SSID);
+
+    int wifi_attempts = 0;
+    while (WiFi.status() != WL_CONNECTED && wifi_attempts < 30) {
+      delay(500);
+      Serial.print(".");
+      wifi_attempts++;
+    }
   }
-  
+
   if (WiFi.status() == WL_CONNECTED) {
+    fast_boot_wifi_save();
     Serial.println("\nWiFi connected successfully!");
     Serial.printf("IP address: %s\n", WiFi.localIP().toString().c_str());
     Serial.printf("MAC address: %s\n", WiFi.macAddress().c_str());
     
-    // Start streaming web server
+    // Start streaming web server and the UDP/RTP sender
     startCameraServer();
+    rtp_stream_start();
+
+    // Paired-device capture sync: ESP32_CAM_1 broadcasts the tick,
+    // everyone else listens. Gating stays off until /control enables it.
+    espnow_sync_start(strcmp(device_name, "ESP32_CAM_1") == 0);
+
+    // Watch link quality and adapt the stream before TCP stalls
+    link_monitor_start();
     
     Serial.println("\n=== Camera Server Ready ===");
     Serial.printf("Status page: http://%s/\n", WiFi.localIP().toString().c_str());
@@ -331,11 +802,21 @@ void setup() {
 
 void loop() {
   delay(100);
-  
+
+  // Reboot into a freshly flashed image once the maintenance condition holds
+  ota_poll();
+
+  // Refresh the cached /status.json snapshot once per second
+  static unsigned long last_json = 0;
+  if (millis() - last_json >= 1000) {
+    status_json_refresh();
+    last_json = millis();
+  }
+
   // Print periodic status
   static unsigned long last_status = 0;
   if (millis() - last_status > 60000) {  // Every minute
-    Serial.printf("Uptime: %lu seconds, Free heap: %u bytes\n", 
+    Serial.printf("Uptime: %lu seconds, Free heap: %u bytes\n",
                   millis() / 1000, ESP.getFreeHeap());
     last_status = millis();
   }
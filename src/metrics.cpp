@@ -0,0 +1,86 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+metric_hist_t metric_capture_us = {
+  "cam_capture_us", "Sensor frame capture latency in microseconds", {0}, 0, 0
+};
+metric_hist_t metric_send_us = {
+  "cam_send_us", "Per-frame socket send time in microseconds", {0}, 0, 0
+};
+metric_hist_t metric_jpeg_bytes = {
+  "cam_jpeg_bytes", "Published JPEG frame size in bytes", {0}, 0, 0
+};
+
+volatile uint32_t metric_frames_published = 0;
+volatile uint32_t metric_frames_gated = 0;
+volatile uint32_t metric_frames_dropped = 0;
+volatile int metric_stream_clients = 0;
+volatile int metric_wifi_rssi = 0;
+
+void metric_hist_record(metric_hist_t *h, uint32_t value) {
+  // Ceiling bucket: bucket i counts values in (2^(i-1), 2^i], matching
+  // the le="2^i" labels the exposition prints
+  int b = 0;
+  while (b < METRIC_HIST_BUCKETS - 1 && value > (1u << b)) {
+    b++;
+  }
+  h->buckets[b]++;
+  h->sum += value;
+  h->count++;
+}
+
+// Exposition buffer; /metrics is scraped by one collector, so a single
+// static buffer shared across requests is fine
+static char metrics_buf[4096];
+
+// Clamp after every accumulation: snprintf returns the length it wanted,
+// so off can pass cap on a full buffer and the next cap - off would
+// underflow to a huge size_t
+static size_t clamp_off(size_t off, size_t cap) {
+  return off >= cap ? cap - 1 : off;
+}
+
+static size_t append_hist(char *out, size_t off, size_t cap, const metric_hist_t *h) {
+  off += snprintf(out + off, cap - off, "# HELP %s %s\n# TYPE %s histogram\n",
+                  h->name, h->help, h->name);
+  off = clamp_off(off, cap);
+  uint64_t cumulative = 0;
+  for (int b = 0; b < METRIC_HIST_BUCKETS; b++) {
+    if (h->buckets[b] == 0) continue;  // keep the payload small
+    cumulative += h->buckets[b];
+    off += snprintf(out + off, cap - off, "%s_bucket{le=\"%u\"} %llu\n",
+                    h->name, 1u << b, (unsigned long long)cumulative);
+    off = clamp_off(off, cap);
+  }
+  off += snprintf(out + off, cap - off, "%s_bucket{le=\"+Inf\"} %u\n",
+                  h->name, h->count);
+  off = clamp_off(off, cap);
+  off += snprintf(out + off, cap - off, "%s_sum %llu\n%s_count %u\n",
+                  h->name, (unsigned long long)h->sum, h->name, h->count);
+  return clamp_off(off, cap);
+}
+
+esp_err_t metrics_handler(httpd_req_t *req) {
+  size_t off = 0;
+  const size_t cap = sizeof(metrics_buf);
+
+  off = append_hist(metrics_buf, off, cap, &metric_capture_us);
+  off = append_hist(metrics_buf, off, cap, &metric_send_us);
+  off = append_hist(metrics_buf, off, cap, &metric_jpeg_bytes);
+
+  off += snprintf(metrics_buf + off, cap - off,
+                  "cam_frames_published_total %u\n"
+                  "cam_frames_gated_total %u\n"
+                  "cam_frames_dropped_total %u\n"
+                  "cam_stream_clients %d\n"
+                  "cam_wifi_rssi_dbm %d\n",
+                  metric_frames_published, metric_frames_gated,
+                  metric_frames_dropped, metric_stream_clients,
+                  metric_wifi_rssi);
+  off = clamp_off(off, cap);
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  return httpd_resp_send(req, metrics_buf, off);
+}
@@ -0,0 +1,44 @@
+/*********
+  Hot-path instrumentation for the ESP32-CAM streaming server
+
+  Fixed power-of-two bucket histograms and plain counters, recorded with
+  a handful of integer ops and no allocation, exposed in Prometheus text
+  format via the /metrics HTTP handler.
+*********/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// Buckets are powers of two: bucket i counts values in (2^(i-1), 2^i]
+#define METRIC_HIST_BUCKETS 24
+
+typedef struct {
+  const char *name;  // prometheus metric name (e.g. "cam_capture_us")
+  const char *help;
+  uint32_t buckets[METRIC_HIST_BUCKETS];
+  uint64_t sum;
+  uint32_t count;
+} metric_hist_t;
+
+// Per-stage timing and size histograms
+extern metric_hist_t metric_capture_us;   // esp_camera_fb_get() latency
+extern metric_hist_t metric_send_us;      // per-frame socket send time
+extern metric_hist_t metric_jpeg_bytes;   // published frame size
+
+// Counters
+extern volatile uint32_t metric_frames_published;
+extern volatile uint32_t metric_frames_gated;    // skipped by motion gate
+extern volatile uint32_t metric_frames_dropped;  // skipped past slow clients
+extern volatile int metric_stream_clients;       // currently connected
+extern volatile int metric_wifi_rssi;            // dBm, sampled by link monitor
+
+// Record one sample; safe to call from any task, never allocates
+void metric_hist_record(metric_hist_t *h, uint32_t value);
+
+// /metrics URI handler (register in startCameraServer)
+esp_err_t metrics_handler(httpd_req_t *req);
+
+#endif  // METRICS_H
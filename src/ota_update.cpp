@@ -0,0 +1,116 @@
+#include "ota_update.h"
+
+#include <string.h>
+
+#include "Arduino.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "metrics.h"
+
+// Throttle flash writes: pause after every burst so the flash cache
+// stalls the upload causes stay short and the stream keeps its FPS.
+// ~256 KB/s worst case - a 1.5 MB image lands in under 10 s.
+#define OTA_CHUNK_BYTES  4096
+#define OTA_BURST_BYTES  (64 * 1024)
+#define OTA_BURST_PAUSE_MS 50
+
+volatile int ota_reboot_max_s = 600;
+
+static volatile bool reboot_pending = false;
+static int64_t flashed_us = 0;
+
+esp_err_t ota_handler(httpd_req_t *req) {
+  if (reboot_pending) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Update already pending reboot");
+    return ESP_FAIL;
+  }
+
+  const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+  if (!next) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                        "No OTA partition (single-app partition table?)");
+    return ESP_FAIL;
+  }
+
+  esp_ota_handle_t handle;
+  if (esp_ota_begin(next, OTA_SIZE_UNKNOWN, &handle) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA begin failed");
+    return ESP_FAIL;
+  }
+
+  Serial.printf("OTA: flashing %s (%u bytes incoming)\n", next->label,
+                (unsigned)req->content_len);
+
+  static char chunk[OTA_CHUNK_BYTES];
+  size_t received = 0;
+  size_t burst = 0;
+  bool first = true;
+
+  while (received < req->content_len) {
+    int n = httpd_req_recv(req, chunk, sizeof(chunk));
+    if (n <= 0) {
+      if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+      esp_ota_abort(handle);
+      Serial.println("OTA: upload aborted");
+      return ESP_FAIL;
+    }
+
+    // Cheap reject before any flash wear: app images start with 0xE9
+    if (first) {
+      first = false;
+      if ((uint8_t)chunk[0] != 0xE9) {
+        esp_ota_abort(handle);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not an app image");
+        return ESP_FAIL;
+      }
+    }
+
+    if (esp_ota_write(handle, chunk, n) != ESP_OK) {
+      esp_ota_abort(handle);
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Flash write failed");
+      return ESP_FAIL;
+    }
+    received += n;
+    burst += n;
+
+    if (burst >= OTA_BURST_BYTES) {
+      burst = 0;
+      vTaskDelay(pdMS_TO_TICKS(OTA_BURST_PAUSE_MS));
+    }
+  }
+
+  // esp_ota_end runs the full image validation (checksum, and signature
+  // when secure boot is enabled) before we dare switch boot partitions
+  if (esp_ota_end(handle) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image validation failed");
+    return ESP_FAIL;
+  }
+  if (esp_ota_set_boot_partition(next) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Boot switch failed");
+    return ESP_FAIL;
+  }
+
+  reboot_pending = true;
+  flashed_us = esp_timer_get_time();
+  Serial.printf("OTA: %u bytes flashed to %s, reboot pending\n",
+                (unsigned)received, next->label);
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_sendstr(req, "OK, reboot scheduled");
+}
+
+void ota_poll() {
+  if (!reboot_pending) return;
+
+  int64_t waited_s = (esp_timer_get_time() - flashed_us) / 1000000;
+  if (metric_stream_clients > 0 && waited_s < ota_reboot_max_s) {
+    return;  // viewers attached and the forced deadline hasn't passed
+  }
+
+  Serial.printf("OTA: rebooting into new image (waited %llds)\n",
+                (long long)waited_s);
+  delay(100);  // let the log line drain
+  esp_restart();
+}
@@ -0,0 +1,36 @@
+/*********
+  Over-the-air updates for the ESP32-CAM streaming server
+
+  POST an app image to /ota and it is written to the inactive app
+  partition while the active image keeps streaming; flash writes are
+  rate-limited so the capture and send paths hold their FPS through the
+  upload. The image is validated (header magic plus the bootloader's
+  image checks in esp_ota_end) before the boot partition is switched.
+
+  The reboot into the new image is deferred to a maintenance window:
+  the device restarts as soon as no stream clients are attached, or
+  after ota_reboot_max_s regardless, whichever comes first. The fleet
+  has no wall clock (no NTP), so "no viewers" stands in for an
+  hour-of-day window.
+
+  Requires an OTA-capable partition table (board_build.partitions in
+  platformio.ini); on a single-app table /ota reports 500.
+*********/
+
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include "esp_http_server.h"
+
+// Force the reboot this long after a successful flash even if clients
+// never disconnect (/control?var=ota_max_wait)
+extern volatile int ota_reboot_max_s;
+
+// /ota URI handler (HTTP POST, body = app image)
+esp_err_t ota_handler(httpd_req_t *req);
+
+// Housekeeping hook, called from loop(): performs the deferred reboot
+// once a flashed image is pending and the maintenance condition is met
+void ota_poll();
+
+#endif  // OTA_UPDATE_H
@@ -0,0 +1,158 @@
+#include "replay_ring.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Arduino.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+typedef struct {
+  uint32_t offset;  // into the arena
+  uint32_t len;
+  int64_t timestamp_us;
+  uint32_t seq;
+} replay_entry_t;
+
+static uint8_t *arena = NULL;
+static size_t write_off = 0;
+static replay_entry_t index_ring[REPLAY_MAX_FRAMES];
+static int idx_tail = 0;  // oldest entry
+static int idx_count = 0;
+static SemaphoreHandle_t ring_lock = NULL;
+
+// Scratch frame for copying records out under the lock
+static uint8_t *scratch = NULL;
+static size_t scratch_cap = 0;
+
+static const char* _REPLAY_BOUNDARY = "\r\n--replayframe\r\n";
+static const char* _REPLAY_PART =
+  "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld\r\n\r\n";
+
+bool replay_ring_start() {
+  if (!psramFound()) {
+    Serial.println("Replay ring disabled (no PSRAM)");
+    return true;
+  }
+  arena = (uint8_t *)ps_malloc(REPLAY_ARENA_BYTES);
+  scratch_cap = 128 * 1024;
+  scratch = (uint8_t *)ps_malloc(scratch_cap);
+  ring_lock = xSemaphoreCreateMutex();
+  if (!arena || !scratch || !ring_lock) {
+    Serial.println("Failed to allocate replay ring");
+    arena = NULL;
+    return false;
+  }
+  Serial.printf("Replay ring: %u KB in PSRAM\n", (unsigned)(REPLAY_ARENA_BYTES / 1024));
+  return true;
+}
+
+static bool entry_overlaps(const replay_entry_t *e, size_t off, size_t need) {
+  return !(e->offset + e->len <= off || e->offset >= off + need);
+}
+
+void replay_ring_store(const uint8_t *buf, size_t len, int64_t timestamp_us,
+                       uint32_t seq) {
+  if (!arena || len > REPLAY_ARENA_BYTES) {
+    return;
+  }
+
+  xSemaphoreTake(ring_lock, portMAX_DELAY);
+
+  if (write_off + len > REPLAY_ARENA_BYTES) {
+    write_off = 0;  // records never straddle the wrap point
+  }
+
+  // Make room in the index first
+  if (idx_count == REPLAY_MAX_FRAMES) {
+    idx_tail = (idx_tail + 1) % REPLAY_MAX_FRAMES;
+    idx_count--;
+  }
+
+  // Evict every entry whose data the new record will overwrite. After
+  // the first arena wrap, entries are no longer in offset order - the
+  // span at write_off can belong to any lap - so overwrite victims may
+  // sit anywhere in the index, not just at the tail. Compact the
+  // survivors to keep the index in time order.
+  int kept = 0;
+  for (int i = 0; i < idx_count; i++) {
+    replay_entry_t e = index_ring[(idx_tail + i) % REPLAY_MAX_FRAMES];
+    if (entry_overlaps(&e, write_off, len)) continue;
+    index_ring[(idx_tail + kept) % REPLAY_MAX_FRAMES] = e;
+    kept++;
+  }
+  idx_count = kept;
+
+  memcpy(arena + write_off, buf, len);
+  replay_entry_t *e = &index_ring[(idx_tail + idx_count) % REPLAY_MAX_FRAMES];
+  e->offset = write_off;
+  e->len = len;
+  e->timestamp_us = timestamp_us;
+  e->seq = seq;
+  idx_count++;
+  write_off += len;
+
+  xSemaphoreGive(ring_lock);
+}
+
+esp_err_t replay_handler(httpd_req_t *req) {
+  if (!arena) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Replay requires PSRAM");
+    return ESP_FAIL;
+  }
+
+  // Window defaults to 2 s, capped so a bad request can't loop for long
+  long window_ms = 2000;
+  char query[32];
+  char value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "ms", value, sizeof(value)) == ESP_OK) {
+    window_ms = atol(value);
+    if (window_ms < 100) window_ms = 100;
+    if (window_ms > 30000) window_ms = 30000;
+  }
+  int64_t cutoff_us = esp_timer_get_time() - (int64_t)window_ms * 1000;
+
+  httpd_resp_set_type(req, "multipart/x-mixed-replace;boundary=replayframe");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char part_buf[128];
+  int sent = 0;
+
+  // Walk oldest to newest; copy each in-window record to scratch under
+  // the lock, then send with the lock released so capture keeps running
+  for (int i = 0; i < REPLAY_MAX_FRAMES; i++) {
+    size_t len = 0;
+    int64_t ts = 0;
+
+    xSemaphoreTake(ring_lock, portMAX_DELAY);
+    if (i < idx_count) {
+      replay_entry_t *e = &index_ring[(idx_tail + i) % REPLAY_MAX_FRAMES];
+      if (e->timestamp_us >= cutoff_us && e->len <= scratch_cap) {
+        memcpy(scratch, arena + e->offset, e->len);
+        len = e->len;
+        ts = e->timestamp_us;
+      }
+    } else {
+      xSemaphoreGive(ring_lock);
+      break;
+    }
+    xSemaphoreGive(ring_lock);
+
+    if (len == 0) continue;
+
+    size_t hlen = snprintf(part_buf, sizeof(part_buf), _REPLAY_PART,
+                           (unsigned)len, (long long)ts);
+    if (httpd_resp_send_chunk(req, part_buf, hlen) != ESP_OK ||
+        httpd_resp_send_chunk(req, (const char *)scratch, len) != ESP_OK ||
+        httpd_resp_send_chunk(req, _REPLAY_BOUNDARY, strlen(_REPLAY_BOUNDARY)) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    sent++;
+  }
+
+  Serial.printf("Replay: served %d frames from last %ld ms\n", sent, window_ms);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
@@ -0,0 +1,37 @@
+/*********
+  PSRAM replay ring for the ESP32-CAM streaming server
+
+  Keeps the last few seconds of published JPEG frames in a circular
+  PSRAM arena so the moments *before* an external trigger can be pulled
+  back out with /replay?ms=2000. Frames are teed into the arena by the
+  capture task; readers copy records out under the ring lock, so replay
+  never blocks capture for more than one memcpy.
+*********/
+
+#ifndef REPLAY_RING_H
+#define REPLAY_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_http_server.h"
+
+// Arena and index sizing; ~1 MB holds 2-3 s of SVGA at quality 12. The
+// arena shares the 4 MB PSRAM with the camera framebuffers, the frame
+// rings and the preview/analytics scratch (see frame_broadcast_start),
+// so growing it starves the preview pipeline.
+#define REPLAY_ARENA_BYTES (1024 * 1024)
+#define REPLAY_MAX_FRAMES  128
+
+// Allocate the arena from PSRAM. No-op success on boards without PSRAM
+// (replay simply stays empty). Call once from setup().
+bool replay_ring_start();
+
+// Tee one published frame into the ring (called by the capture task)
+void replay_ring_store(const uint8_t *buf, size_t len, int64_t timestamp_us,
+                       uint32_t seq);
+
+// /replay?ms=<window> URI handler: streams the retained frames from the
+// requested window as multipart MJPEG
+esp_err_t replay_handler(httpd_req_t *req);
+
+#endif  // REPLAY_RING_H
@@ -0,0 +1,241 @@
+#include "rtp_stream.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frame_broadcast.h"
+#include "stream_dispatch.h"  // shared stream_target_fps
+
+// Scan bytes per packet, sized to stay under the WiFi MTU with the RTP
+// (12) and JPEG (8) headers included. The first fragment additionally
+// carries the quantization table block (4 + 128 bytes) and gives up
+// that many scan bytes so no datagram ever needs IP fragmentation -
+// otherwise losing one IP fragment would drop the tables and make the
+// whole frame undecodable.
+#define RTP_MAX_PAYLOAD 1400
+#define RTP_QTABLE_BLOCK (4 + 128)
+#define RTP_PT_JPEG 26
+
+typedef struct {
+  volatile bool active;
+  struct sockaddr_in dest;
+  int sock;
+  uint16_t seq;
+  uint32_t ssrc;
+} rtp_session_t;
+
+static rtp_session_t session;
+static TaskHandle_t rtp_task_handle = NULL;
+
+// Fields pulled out of a baseline JPEG for RFC 2435 packetization
+typedef struct {
+  const uint8_t *scan;      // entropy-coded data after SOS
+  size_t scan_len;
+  const uint8_t *qtables[2];  // 64-byte luma/chroma tables
+  int qtable_count;
+  uint16_t width;
+  uint16_t height;
+} jpeg_info_t;
+
+// Minimal baseline-JPEG marker walk: find the quantization tables, the
+// frame dimensions and the start of scan data
+static bool jpeg_parse(const uint8_t *buf, size_t len, jpeg_info_t *info) {
+  memset(info, 0, sizeof(*info));
+  if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) {
+    return false;
+  }
+
+  size_t off = 2;
+  while (off + 4 <= len) {
+    if (buf[off] != 0xFF) return false;
+    uint8_t marker = buf[off + 1];
+    size_t seg_len = ((size_t)buf[off + 2] << 8) | buf[off + 3];
+    if (off + 2 + seg_len > len) return false;
+
+    if (marker == 0xDB) {
+      // DQT segment: one or more (precision/id byte + 64 entries)
+      size_t p = off + 4;
+      size_t end = off + 2 + seg_len;
+      while (p + 65 <= end && info->qtable_count < 2) {
+        if ((buf[p] >> 4) != 0) return false;  // 16-bit tables unsupported
+        info->qtables[info->qtable_count++] = &buf[p + 1];
+        p += 65;
+      }
+    } else if (marker == 0xC0) {
+      info->height = ((uint16_t)buf[off + 5] << 8) | buf[off + 6];
+      info->width = ((uint16_t)buf[off + 7] << 8) | buf[off + 8];
+    } else if (marker == 0xDA) {
+      info->scan = buf + off + 2 + seg_len;
+      info->scan_len = len - (off + 2 + seg_len);
+      // Trim the trailing EOI marker if present
+      if (info->scan_len >= 2 &&
+          info->scan[info->scan_len - 2] == 0xFF &&
+          info->scan[info->scan_len - 1] == 0xD9) {
+        info->scan_len -= 2;
+      }
+      return info->width && info->height && info->qtable_count == 2;
+    }
+    off += 2 + seg_len;
+  }
+  return false;
+}
+
+static void rtp_send_frame(const frame_slot_t *slot) {
+  jpeg_info_t info;
+  if (!jpeg_parse(slot->buf, slot->len, &info)) {
+    return;  // not a packetizable baseline JPEG; skip this frame
+  }
+
+  uint8_t pkt[12 + 8 + 4 + 128 + RTP_MAX_PAYLOAD];
+  uint32_t rtp_ts = (uint32_t)((slot->timestamp_us * 9) / 100);  // 90 kHz clock
+  size_t frag_off = 0;
+
+  while (frag_off < info.scan_len) {
+    size_t max_payload = RTP_MAX_PAYLOAD;
+    if (frag_off == 0) max_payload -= RTP_QTABLE_BLOCK;
+    size_t payload = info.scan_len - frag_off;
+    bool last = payload <= max_payload;
+    if (!last) payload = max_payload;
+
+    size_t n = 0;
+    // RTP header
+    pkt[n++] = 0x80;  // V=2
+    pkt[n++] = RTP_PT_JPEG | (last ? 0x80 : 0);  // marker on final fragment
+    pkt[n++] = session.seq >> 8;
+    pkt[n++] = session.seq & 0xFF;
+    session.seq++;
+    pkt[n++] = rtp_ts >> 24; pkt[n++] = rtp_ts >> 16;
+    pkt[n++] = rtp_ts >> 8;  pkt[n++] = rtp_ts;
+    pkt[n++] = session.ssrc >> 24; pkt[n++] = session.ssrc >> 16;
+    pkt[n++] = session.ssrc >> 8;  pkt[n++] = session.ssrc;
+
+    // JPEG payload header (RFC 2435 sec 3.1)
+    pkt[n++] = 0;  // type-specific
+    pkt[n++] = frag_off >> 16; pkt[n++] = frag_off >> 8; pkt[n++] = frag_off;
+    pkt[n++] = 0;    // type 0: 4:2:2, no restart markers
+    pkt[n++] = 255;  // Q=255: tables follow in the first fragment
+    pkt[n++] = info.width / 8;
+    pkt[n++] = info.height / 8;
+
+    if (frag_off == 0) {
+      // Quantization table header + both 64-byte tables
+      pkt[n++] = 0; pkt[n++] = 0;  // MBZ, precision
+      pkt[n++] = 0; pkt[n++] = 128;
+      memcpy(&pkt[n], info.qtables[0], 64); n += 64;
+      memcpy(&pkt[n], info.qtables[1], 64); n += 64;
+    }
+
+    memcpy(&pkt[n], info.scan + frag_off, payload);
+    n += payload;
+    frag_off += payload;
+
+    if (sendto(session.sock, pkt, n, 0, (struct sockaddr *)&session.dest,
+               sizeof(session.dest)) < 0) {
+      // UDP send failures are transient (ARP, buffer pressure); drop the
+      // rest of this frame and let the next one start clean
+      return;
+    }
+  }
+}
+
+static void rtp_task(void *arg) {
+  frame_cursor_t cursor;
+  frame_cursor_init(&cursor);
+
+  while (true) {
+    if (!session.active) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      frame_cursor_init(&cursor);  // resync when a session starts
+      continue;
+    }
+
+    int64_t frame_start_us = esp_timer_get_time();
+    frame_slot_t *slot = frame_broadcast_acquire(&cursor, FRAME_MODE_LATEST,
+                                                 pdMS_TO_TICKS(1000));
+    if (slot) {
+      rtp_send_frame(slot);
+      frame_broadcast_release(slot);
+    }
+
+    int64_t budget_us = 1000000 / stream_target_fps;
+    int64_t elapsed_us = esp_timer_get_time() - frame_start_us;
+    if (elapsed_us < budget_us) {
+      vTaskDelay(pdMS_TO_TICKS((budget_us - elapsed_us) / 1000));
+    }
+  }
+}
+
+bool rtp_stream_active() {
+  return session.active;
+}
+
+bool rtp_stream_start() {
+  memset(&session, 0, sizeof(session));
+  session.sock = -1;
+  if (xTaskCreatePinnedToCore(rtp_task, "rtp_stream", 4096, NULL, 5,
+                              &rtp_task_handle, 1) != pdPASS) {
+    Serial.println("Failed to start RTP sender");
+    return false;
+  }
+  return true;
+}
+
+esp_err_t rtp_session_handler(httpd_req_t *req) {
+  char query[32];
+  char value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "port", value, sizeof(value)) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected ?port=<n> (0 stops)");
+    return ESP_FAIL;
+  }
+  int port = atoi(value);
+
+  if (port == 0) {
+    session.active = false;
+    if (session.sock >= 0) {
+      close(session.sock);
+      session.sock = -1;
+    }
+    Serial.println("RTP session stopped");
+    return httpd_resp_sendstr(req, "RTP stopped");
+  }
+
+  // Send to whoever asked: take the peer address from the HTTP socket
+  struct sockaddr_in6 peer;
+  socklen_t peer_len = sizeof(peer);
+  int http_sock = httpd_req_to_sockfd(req);
+  if (http_sock < 0 ||
+      getpeername(http_sock, (struct sockaddr *)&peer, &peer_len) != 0) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No peer address");
+    return ESP_FAIL;
+  }
+
+  session.active = false;
+  if (session.sock >= 0) close(session.sock);
+
+  session.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (session.sock < 0) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Socket failed");
+    return ESP_FAIL;
+  }
+
+  memset(&session.dest, 0, sizeof(session.dest));
+  session.dest.sin_family = AF_INET;
+  session.dest.sin_port = htons(port);
+  // lwip maps IPv4 peers into v6 sockaddrs; the v4 address is the tail
+  memcpy(&session.dest.sin_addr,
+         (uint8_t *)&peer.sin6_addr + sizeof(peer.sin6_addr) - 4, 4);
+
+  session.seq = 0;
+  session.ssrc = esp_random();
+  session.active = true;
+
+  Serial.printf("RTP session to %s:%d\n", inet_ntoa(session.dest.sin_addr), port);
+  return httpd_resp_sendstr(req, "RTP started");
+}
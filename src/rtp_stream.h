@@ -0,0 +1,27 @@
+/*********
+  RTP/JPEG (RFC 2435) transport for the ESP32-CAM streaming server
+
+  UDP alternative to the TCP multipart stream for latency-critical
+  consumers: a lost WiFi packet corrupts one frame instead of stalling
+  the whole stream behind TCP retransmits. A session is started over
+  HTTP (/rtp?port=5004 sends to the requester's address) and fed from
+  the same frame broadcaster as every other transport.
+*********/
+
+#ifndef RTP_STREAM_H
+#define RTP_STREAM_H
+
+#include "esp_http_server.h"
+
+// Start the sender task; it idles until a session is opened
+bool rtp_stream_start();
+
+// /rtp URI handler: ?port=<n> opens a session to the requesting host,
+// ?port=0 closes it. One session at a time.
+esp_err_t rtp_session_handler(httpd_req_t *req);
+
+// True while an RTP session is open; RTP consumers are not counted in
+// metric_stream_clients, so the capture loop's idle park checks this too
+bool rtp_stream_active();
+
+#endif  // RTP_STREAM_H
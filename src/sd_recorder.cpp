@@ -0,0 +1,270 @@
+#include "sd_recorder.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Arduino.h"
+#include "FS.h"
+#include "SD_MMC.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frame_broadcast.h"
+
+#define REC_DIR "/rec"
+#define REC_MAGIC 0x43455253  // "SREC" little-endian
+
+// Write-behind staging buffer: frames accumulate here and go to the card
+// in one large sequential write, which is what the SDMMC DMA path likes.
+// Sized for a couple of SVGA frames plus headers.
+#define REC_STAGE_BYTES (96 * 1024)
+
+// Flush a partially filled stage at least this often so a power cut
+// costs bounded footage
+#define REC_FLUSH_MS 2000
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t length;
+  int64_t timestamp_us;
+  uint32_t seq;
+} rec_frame_header_t;
+
+volatile bool record_enabled = false;
+volatile int record_fps = 5;
+
+static bool card_ok = false;
+static uint8_t *stage = NULL;
+static size_t stage_len = 0;
+static int64_t last_flush_us = 0;
+
+static File seg_file;
+static uint32_t seg_index = 0;   // next segment number to create
+static uint32_t seg_oldest = 0;  // oldest segment still on the card
+static size_t seg_bytes = 0;
+
+static TaskHandle_t recorder_task_handle = NULL;
+
+static void seg_path(char *out, size_t cap, uint32_t index) {
+  snprintf(out, cap, REC_DIR "/seg_%05u.mjr", (unsigned)index);
+}
+
+// Ring behaviour: before opening a new segment, delete the oldest one
+// once the cap is reached
+static bool open_next_segment() {
+  char path[40];
+
+  while (seg_index - seg_oldest >= REC_MAX_SEGMENTS) {
+    seg_path(path, sizeof(path), seg_oldest);
+    SD_MMC.remove(path);
+    seg_oldest++;
+  }
+
+  seg_path(path, sizeof(path), seg_index);
+  seg_file = SD_MMC.open(path, FILE_WRITE);
+  if (!seg_file) {
+    Serial.printf("Failed to open %s, recording stopped\n", path);
+    return false;
+  }
+  seg_bytes = 0;
+  seg_index++;
+  return true;
+}
+
+static bool flush_stage() {
+  if (stage_len == 0) return true;
+
+  if (!seg_file && !open_next_segment()) {
+    return false;
+  }
+  size_t written = seg_file.write(stage, stage_len);
+  if (written != stage_len) {
+    Serial.println("SD write failed, recording stopped");
+    seg_file.close();
+    return false;
+  }
+  seg_bytes += stage_len;
+  stage_len = 0;
+  last_flush_us = esp_timer_get_time();
+
+  if (seg_bytes >= REC_SEGMENT_BYTES) {
+    seg_file.close();  // roll to a fresh segment on the next flush
+  }
+  return true;
+}
+
+// The recorder is just another ring consumer: it holds a slot only for
+// the memcpy into the stage, then does the (slow) SD write with nothing
+// shared with the capture or stream paths.
+static void recorder_task(void *arg) {
+  frame_cursor_t cursor;
+  frame_cursor_init(&cursor);
+  int64_t next_due_us = 0;
+
+  while (true) {
+    if (!record_enabled || !card_ok) {
+      vTaskDelay(pdMS_TO_TICKS(200));
+      frame_cursor_init(&cursor);  // resume from live frames, not backlog
+      next_due_us = 0;
+      continue;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    if (now_us < next_due_us) {
+      vTaskDelay(pdMS_TO_TICKS((next_due_us - now_us) / 1000 + 1));
+      continue;
+    }
+    int fps = record_fps > 0 ? record_fps : 1;
+    next_due_us = now_us + 1000000 / fps;
+
+    frame_slot_t *slot = frame_broadcast_acquire(&cursor, FRAME_MODE_LATEST,
+                                                 pdMS_TO_TICKS(100));
+    if (!slot) continue;
+
+    size_t need = sizeof(rec_frame_header_t) + slot->len;
+    if (need > REC_STAGE_BYTES) {
+      frame_broadcast_release(slot);
+      continue;  // frame larger than the stage; skip rather than grow
+    }
+    if (stage_len + need > REC_STAGE_BYTES) {
+      // Release before touching the SD bus - a ring slot must never wait
+      // on a card write. This frame is dropped; the next one lands in
+      // the freshly drained stage.
+      frame_broadcast_release(slot);
+      if (!flush_stage()) {
+        record_enabled = false;
+      }
+      continue;
+    }
+
+    rec_frame_header_t *hdr = (rec_frame_header_t *)(stage + stage_len);
+    hdr->magic = REC_MAGIC;
+    hdr->length = slot->len;
+    hdr->timestamp_us = slot->timestamp_us;
+    hdr->seq = slot->seq;
+    memcpy(stage + stage_len + sizeof(*hdr), slot->buf, slot->len);
+    stage_len += need;
+    frame_broadcast_release(slot);
+
+    if (esp_timer_get_time() - last_flush_us > (int64_t)REC_FLUSH_MS * 1000) {
+      if (!flush_stage()) {
+        record_enabled = false;
+      }
+    }
+  }
+}
+
+bool sd_recorder_start() {
+  // 4-bit SDMMC; the slot shares GPIO4 with the flash LED, which stays
+  // unused by this firmware
+  if (!SD_MMC.begin()) {
+    Serial.println("No SD card - recorder disabled");
+    return false;
+  }
+  SD_MMC.mkdir(REC_DIR);
+
+  // Resume numbering after the newest segment already on the card
+  File dir = SD_MMC.open(REC_DIR);
+  if (dir) {
+    File f;
+    while ((f = dir.openNextFile())) {
+      unsigned n;
+      if (sscanf(f.name(), "seg_%u", &n) == 1) {
+        if (n >= seg_index) seg_index = n + 1;
+        if (seg_oldest == 0 || n < seg_oldest) seg_oldest = n;
+      }
+      f.close();
+    }
+    dir.close();
+  }
+  if (seg_oldest > seg_index) seg_oldest = seg_index;
+
+  stage = psramFound() ? (uint8_t *)ps_malloc(REC_STAGE_BYTES)
+                       : (uint8_t *)malloc(REC_STAGE_BYTES);
+  if (!stage) {
+    Serial.println("Failed to allocate recorder stage");
+    return false;
+  }
+
+  if (xTaskCreatePinnedToCore(recorder_task, "sd_recorder", 4096, NULL, 3,
+                              &recorder_task_handle, 1) != pdPASS) {
+    Serial.println("Failed to start recorder task");
+    return false;
+  }
+
+  card_ok = true;
+  Serial.printf("SD recorder ready: %llu MB card, segments from %u\n",
+                SD_MMC.cardSize() / (1024 * 1024), (unsigned)seg_index);
+  return true;
+}
+
+bool sd_recorder_active() {
+  return record_enabled && card_ok;
+}
+
+esp_err_t recordings_handler(httpd_req_t *req) {
+  if (!card_ok) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No SD card");
+    return ESP_FAIL;
+  }
+
+  char query[64];
+  char name[32];
+
+  // ?file=seg_00001.mjr streams one segment back
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "file", name, sizeof(name)) == ESP_OK) {
+    // Only our own segment names; no path components
+    if (strncmp(name, "seg_", 4) != 0 || strchr(name, '/') != NULL) {
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad segment name");
+      return ESP_FAIL;
+    }
+    char path[48];
+    snprintf(path, sizeof(path), REC_DIR "/%s", name);
+    File f = SD_MMC.open(path, FILE_READ);
+    if (!f) {
+      httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such segment");
+      return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    static uint8_t read_buf[8 * 1024];
+    size_t n;
+    while ((n = f.read(read_buf, sizeof(read_buf))) > 0) {
+      if (httpd_resp_send_chunk(req, (const char *)read_buf, n) != ESP_OK) {
+        f.close();
+        return ESP_FAIL;
+      }
+    }
+    f.close();
+    return httpd_resp_send_chunk(req, NULL, 0);
+  }
+
+  // No query: list segments as JSON
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_send_chunk(req, "[", 1);
+
+  File dir = SD_MMC.open(REC_DIR);
+  bool first = true;
+  if (dir) {
+    File f;
+    char line[80];
+    while ((f = dir.openNextFile())) {
+      int len = snprintf(line, sizeof(line), "%s{\"file\":\"%s\",\"bytes\":%u}",
+                         first ? "" : ",", f.name(), (unsigned)f.size());
+      f.close();
+      first = false;
+      if (httpd_resp_send_chunk(req, line, len) != ESP_OK) {
+        dir.close();
+        return ESP_FAIL;
+      }
+    }
+    dir.close();
+  }
+  httpd_resp_send_chunk(req, "]\n", 2);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
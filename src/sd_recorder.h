@@ -0,0 +1,47 @@
+/*********
+  SD card ring recorder for the ESP32-CAM streaming server
+
+  Tees published frames into append-only segment files on the AI-Thinker
+  board's SD slot (SDMMC 4-bit, DMA-backed writes) so footage survives
+  WiFi drops. A dedicated low-priority task copies each frame out of the
+  broadcast ring into a preallocated write-behind buffer and flushes it
+  to the card in large sequential chunks - the capture and stream paths
+  never wait on the SD bus. Old segments are deleted ring-style once the
+  segment cap is reached; /recordings pulls them back over HTTP.
+
+  Segment format: a flat sequence of records, each
+    uint32 magic "SREC" | uint32 length | int64 timestamp_us | uint32 seq
+  followed by the JPEG bytes.
+*********/
+
+#ifndef SD_RECORDER_H
+#define SD_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_http_server.h"
+
+// Segment files roll at 4 MB; the ring keeps at most 32 of them (~128 MB)
+#define REC_SEGMENT_BYTES  (4 * 1024 * 1024)
+#define REC_MAX_SEGMENTS   32
+
+// Mount the card and start the recorder task. Returns false (and leaves
+// recording disabled) when no card is present - streaming is unaffected.
+// Call once from setup() after frame_broadcast_start().
+bool sd_recorder_start();
+
+// Recording on/off and the tee rate (/control vars record, record_fps).
+// Off by default; the task idles when disabled.
+extern volatile bool record_enabled;
+extern volatile int record_fps;
+
+// True while recording is enabled and a card is mounted; the capture
+// loop's idle park checks this so local recording (the WiFi-down case
+// this module exists for) keeps the pipeline awake with no HTTP clients
+bool sd_recorder_active();
+
+// /recordings URI handler: no query lists segments as JSON,
+// ?file=<segment> streams one segment back
+esp_err_t recordings_handler(httpd_req_t *req);
+
+#endif  // SD_RECORDER_H
@@ -0,0 +1,24 @@
+#include "sensor_lock.h"
+
+#include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static SemaphoreHandle_t lock = NULL;
+
+bool sensor_lock_init() {
+  lock = xSemaphoreCreateMutex();
+  if (!lock) {
+    Serial.println("Failed to create sensor lock");
+    return false;
+  }
+  return true;
+}
+
+void sensor_lock() {
+  if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+void sensor_unlock() {
+  if (lock) xSemaphoreGive(lock);
+}
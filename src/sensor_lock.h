@@ -0,0 +1,22 @@
+/*********
+  Serialized sensor register access for the ESP32-CAM streaming server
+
+  Sensor writes now come from several tasks: the capture loop (adaptive
+  quality), the link monitor (rate adaptation) and httpd handlers
+  (/control, /roi). OV2640 register access is bank-switched (0xFF bank
+  select), so two interleaved set_*() sequences can land writes in the
+  wrong bank and corrupt sensor state. Every s->set_*() call must run
+  with this lock held.
+*********/
+
+#ifndef SENSOR_LOCK_H
+#define SENSOR_LOCK_H
+
+// Create the lock; call once from setup() right after esp_camera_init()
+// and before any task that touches the sensor starts
+bool sensor_lock_init();
+
+void sensor_lock();
+void sensor_unlock();
+
+#endif  // SENSOR_LOCK_H
@@ -0,0 +1,451 @@
+#include "stream_dispatch.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "metrics.h"
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+
+static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+
+// X-Timestamp is the sensor capture time in microseconds and X-Frame-Seq
+// the broadcaster's frame number, so clients can pair frames from two
+// devices precisely and detect drops without arrival-time heuristics.
+// X-Sync-Tick carries the shared ESP-NOW capture tick (0 when sync is
+// off); two devices gated on the same tick report the same number.
+static const char* _STREAM_PART =
+  "Content-Type: image/jpeg\r\nContent-Length: %u\r\n"
+  "X-Timestamp: %lld\r\nX-Frame-Seq: %u\r\nX-Sync-Tick: %u\r\n\r\n";
+
+// Raw response headers, sent once per connection before the request is
+// handed to the dispatcher; the frame loop writes straight to the socket
+static const char* _RESPONSE_HEADER_MJPEG =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+static const char* _RESPONSE_HEADER_BIN =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: application/octet-stream\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+// Binary protocol frame header (see /stream.bin)
+#define STREAM_BIN_MAGIC 0x47504A45  // "EJPG" little-endian
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t length;
+  int64_t timestamp_us;
+} stream_bin_header_t;
+
+typedef struct {
+  bool in_use;
+  int sock;
+  httpd_req_t *async_req;
+  stream_proto_t proto;
+  frame_mode_t mode;
+  frame_variant_t variant;
+  stream_prio_t prio;
+  int fps;              // 0 = follow stream_target_fps
+  int64_t next_due_us;  // per-client pacing deadline
+  volatile int credits; // WS only: frames the client is ready to take
+  frame_cursor_t cursor;
+  uint32_t frames_sent;
+  uint32_t drops_reported;  // cursor.dropped already folded into /metrics
+} stream_client_t;
+
+volatile int stream_target_fps = 30;
+
+static stream_client_t clients[MAX_STREAM_CLIENTS];
+static SemaphoreHandle_t clients_mutex = NULL;
+static httpd_handle_t server_handle = NULL;
+static TaskHandle_t dispatch_task_handle = NULL;
+
+// Push an iovec batch out the socket, retrying on partial writes
+static esp_err_t stream_send_iov(int sock, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t sent = writev(sock, iov, iovcnt);
+    if (sent < 0) {
+      return ESP_FAIL;
+    }
+    while (sent > 0 && iovcnt > 0) {
+      if ((size_t)sent >= iov->iov_len) {
+        sent -= iov->iov_len;
+        iov++;
+        iovcnt--;
+      } else {
+        iov->iov_base = (uint8_t *)iov->iov_base + sent;
+        iov->iov_len -= sent;
+        sent = 0;
+      }
+    }
+  }
+  return ESP_OK;
+}
+
+static esp_err_t send_frame(stream_client_t *c, frame_slot_t *slot) {
+  struct iovec iov[3];
+  char part_buf[128];
+  stream_bin_header_t bin_hdr;
+  int iovcnt;
+
+  if (c->proto == STREAM_PROTO_WS) {
+    httpd_ws_frame_t ws_frame;
+    memset(&ws_frame, 0, sizeof(ws_frame));
+    ws_frame.final = true;
+    ws_frame.type = HTTPD_WS_TYPE_BINARY;
+    ws_frame.payload = slot->buf;
+    ws_frame.len = slot->len;
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t res = httpd_ws_send_frame_async(server_handle, c->sock, &ws_frame);
+    metric_hist_record(&metric_send_us, (uint32_t)(esp_timer_get_time() - t0));
+    return res;
+  }
+
+  if (c->proto == STREAM_PROTO_MJPEG) {
+    size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, slot->len,
+                           (long long)slot->timestamp_us, slot->seq,
+                           slot->sync_tick);
+    iov[0].iov_base = part_buf;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = (void *)slot->buf;
+    iov[1].iov_len = slot->len;
+    iov[2].iov_base = (void *)_STREAM_BOUNDARY;
+    iov[2].iov_len = strlen(_STREAM_BOUNDARY);
+    iovcnt = 3;
+  } else {
+    bin_hdr.magic = STREAM_BIN_MAGIC;
+    bin_hdr.length = slot->len;
+    bin_hdr.timestamp_us = slot->timestamp_us;
+    iov[0].iov_base = &bin_hdr;
+    iov[0].iov_len = sizeof(bin_hdr);
+    iov[1].iov_base = (void *)slot->buf;
+    iov[1].iov_len = slot->len;
+    iovcnt = 2;
+  }
+
+  int64_t t0 = esp_timer_get_time();
+  esp_err_t res = stream_send_iov(c->sock, iov, iovcnt);
+  metric_hist_record(&metric_send_us, (uint32_t)(esp_timer_get_time() - t0));
+  return res;
+}
+
+// Release a client slot; callers hold clients_mutex. close_session is
+// false when the underlying httpd session is already being torn down
+// (the close_fn path) and true when we initiate the teardown ourselves.
+static void remove_client(stream_client_t *c, bool close_session) {
+  Serial.printf("Stream client disconnected (%u frames, %u dropped)\n",
+                c->frames_sent, c->cursor.dropped);
+  metric_frames_dropped += c->cursor.dropped - c->drops_reported;
+  metric_stream_clients--;
+  frame_broadcast_touch();  // idle timeout counts from the last disconnect
+  if (c->variant == FRAME_VARIANT_PREVIEW) {
+    preview_clients--;
+  } else if (c->variant == FRAME_VARIANT_ANALYTICS) {
+    analytics_clients--;
+  }
+
+  // We spoke raw HTTP with Connection: close - tear the session down
+  // rather than letting httpd wait for another request on it. WebSocket
+  // clients have no parked async request; httpd owns their lifecycle.
+  if (close_session) {
+    httpd_sess_trigger_close(server_handle, c->sock);
+  }
+  if (c->async_req) {
+    httpd_req_async_handler_complete(c->async_req);
+    c->async_req = NULL;
+  }
+  c->in_use = false;
+}
+
+void stream_dispatch_sock_closed(int sock) {
+  xSemaphoreTake(clients_mutex, portMAX_DELAY);
+  for (int i = 0; i < MAX_STREAM_CLIENTS; i++) {
+    if (clients[i].in_use && clients[i].sock == sock) {
+      remove_client(&clients[i], false);
+      break;
+    }
+  }
+  xSemaphoreGive(clients_mutex);
+}
+
+// Installed as httpd's close_fn: fires in the httpd task whenever any
+// session dies, including client-initiated closes the dispatcher would
+// never notice - a WebSocket viewer that vanished holding zero credits
+// never triggers a send failure and would otherwise pin its slot (and
+// inflate metric_stream_clients) forever, with its stale entry matching
+// a reused fd's credit grants. With close_fn overridden, closing the fd
+// is on us.
+void stream_dispatch_close_fn(httpd_handle_t hd, int sockfd) {
+  stream_dispatch_sock_closed(sockfd);
+  close(sockfd);
+}
+
+// Contention: set once high-priority clients exist and a cycle overran
+// its frame budget, cleared after the dispatcher has run on budget for
+// a stretch. While set, low-priority clients are paced down.
+#define QOS_CALM_CYCLES 30
+
+static bool qos_contended = false;
+
+// One task serves every stream client: per cycle, each client gets the
+// frame its cursor selects and one send. High-priority clients are all
+// served before any low-priority one, so the freshest frame reaches
+// them without queueing behind a slow viewer's send. Pacing is
+// deadline-based against the shared target FPS.
+static void dispatch_task(void *arg) {
+  Serial.printf("Stream dispatcher running on core %d\n", xPortGetCoreID());
+  int calm_cycles = 0;
+
+  while (true) {
+    int64_t cycle_start_us = esp_timer_get_time();
+    int active = 0;
+    int high_active = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+      stream_prio_t pass_prio = (pass == 0) ? STREAM_PRIO_HIGH : STREAM_PRIO_LOW;
+
+      for (int i = 0; i < MAX_STREAM_CLIENTS; i++) {
+        // Snapshot the socket too: the close_fn can reap this entry (and
+        // a new client can claim the slot) while we send without the lock
+        xSemaphoreTake(clients_mutex, portMAX_DELAY);
+        stream_client_t *c =
+            (clients[i].in_use && clients[i].prio == pass_prio) ? &clients[i]
+                                                                : NULL;
+        int csock = c ? c->sock : -1;
+        xSemaphoreGive(clients_mutex);
+        if (!c) continue;
+        active++;
+        if (pass_prio == STREAM_PRIO_HIGH) high_active++;
+
+        // Per-client pacing: record-profile clients take a frame only when
+        // their own (slower) deadline comes due. Under contention low-
+        // priority clients are capped to a quarter of the target rate so
+        // the high tier keeps its full FPS.
+        int fps = c->fps;
+        if (c->prio == STREAM_PRIO_LOW && qos_contended && high_active > 0) {
+          int cap = stream_target_fps / 4;
+          if (cap < 2) cap = 2;
+          if (fps == 0 || fps > cap) fps = cap;
+        }
+        int64_t now_us = esp_timer_get_time();
+        if (fps > 0) {
+          if (now_us < c->next_due_us) continue;
+          c->next_due_us = now_us + 1000000 / fps;
+        }
+
+        // WebSocket clients only get a frame when they've signalled credit
+        if (c->proto == STREAM_PROTO_WS && c->credits <= 0) continue;
+
+        frame_slot_t *slot = frame_broadcast_acquire_variant(&c->cursor, c->mode,
+                                                             c->variant, 0);
+        if (!slot) continue;  // nothing new for this client this cycle
+
+        // Fold skips into the scrapeable aggregate as they happen, not
+        // only at disconnect - a slow client shows up in /metrics live
+        if (c->cursor.dropped != c->drops_reported) {
+          metric_frames_dropped += c->cursor.dropped - c->drops_reported;
+          c->drops_reported = c->cursor.dropped;
+        }
+
+        esp_err_t res = send_frame(c, slot);
+        frame_broadcast_release(slot);
+
+        if (res == ESP_OK) {
+          c->frames_sent++;
+          if (c->proto == STREAM_PROTO_WS) {
+            // Grants arrive from the httpd task under clients_mutex;
+            // an unlocked decrement here could lose one
+            xSemaphoreTake(clients_mutex, portMAX_DELAY);
+            if (c->in_use && c->sock == csock) c->credits--;
+            xSemaphoreGive(clients_mutex);
+          }
+        } else {
+          xSemaphoreTake(clients_mutex, portMAX_DELAY);
+          // Skip if the close_fn already reaped this entry mid-send
+          if (c->in_use && c->sock == csock) {
+            remove_client(c, true);
+          }
+          xSemaphoreGive(clients_mutex);
+        }
+      }
+    }
+
+    if (active == 0) {
+      vTaskDelay(pdMS_TO_TICKS(50));
+      continue;
+    }
+
+    int64_t budget_us = 1000000 / stream_target_fps;
+    int64_t elapsed_us = esp_timer_get_time() - cycle_start_us;
+
+    // Track contention with hysteresis: one overrun with a high-priority
+    // client attached degrades the low tier; a stretch of on-budget
+    // cycles restores it
+    if (high_active > 0 && active > high_active && elapsed_us > budget_us) {
+      if (!qos_contended) {
+        Serial.println("QoS: contention, capping low-priority clients");
+      }
+      qos_contended = true;
+      calm_cycles = 0;
+    } else if (qos_contended) {
+      if (++calm_cycles >= QOS_CALM_CYCLES || high_active == 0) {
+        qos_contended = false;
+        Serial.println("QoS: contention cleared");
+      }
+    }
+
+    if (elapsed_us < budget_us) {
+      vTaskDelay(pdMS_TO_TICKS((budget_us - elapsed_us) / 1000));
+    }
+  }
+}
+
+bool stream_dispatch_start(httpd_handle_t handle) {
+  server_handle = handle;
+  memset(clients, 0, sizeof(clients));
+  clients_mutex = xSemaphoreCreateMutex();
+  if (!clients_mutex) {
+    Serial.println("Failed to create client table mutex");
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(dispatch_task, "stream_dispatch", 6144, NULL, 5,
+                              &dispatch_task_handle, 1) != pdPASS) {
+    Serial.println("Failed to start stream dispatcher");
+    return false;
+  }
+  return true;
+}
+
+esp_err_t stream_dispatch_add(httpd_req_t *req, stream_proto_t proto,
+                              frame_mode_t mode, frame_variant_t variant,
+                              int client_fps, stream_prio_t prio) {
+  int sock = httpd_req_to_sockfd(req);
+  if (sock < 0) {
+    return ESP_FAIL;
+  }
+  frame_broadcast_touch();  // wake a parked pipeline before the first acquire
+
+  const char *hdr = (proto == STREAM_PROTO_MJPEG) ? _RESPONSE_HEADER_MJPEG
+                                                  : _RESPONSE_HEADER_BIN;
+  if (send(sock, hdr, strlen(hdr), 0) < 0) {
+    return ESP_FAIL;
+  }
+
+  httpd_req_t *async_req = NULL;
+  if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+    return ESP_FAIL;
+  }
+
+  xSemaphoreTake(clients_mutex, portMAX_DELAY);
+  stream_client_t *c = NULL;
+  for (int i = 0; i < MAX_STREAM_CLIENTS; i++) {
+    if (!clients[i].in_use) {
+      c = &clients[i];
+      break;
+    }
+  }
+  if (c) {
+    c->in_use = true;
+    c->sock = sock;
+    c->async_req = async_req;
+    c->proto = proto;
+    c->mode = mode;
+    c->variant = variant;
+    c->prio = prio;
+    c->fps = client_fps;
+    c->next_due_us = 0;
+    c->credits = 0;
+    c->frames_sent = 0;
+    c->drops_reported = 0;
+    frame_cursor_init_variant(&c->cursor, variant);
+    metric_stream_clients++;
+    if (variant == FRAME_VARIANT_PREVIEW) {
+      preview_clients++;
+    } else if (variant == FRAME_VARIANT_ANALYTICS) {
+      analytics_clients++;
+    }
+  }
+  xSemaphoreGive(clients_mutex);
+
+  if (!c) {
+    Serial.println("Stream client table full, rejecting");
+    httpd_req_async_handler_complete(async_req);
+    return ESP_FAIL;
+  }
+
+  Serial.printf("Stream client connected (proto=%s, mode=%s, prio=%s)\n",
+                proto == STREAM_PROTO_MJPEG ? "mjpeg" : "bin",
+                mode == FRAME_MODE_LATEST ? "latest" : "all",
+                prio == STREAM_PRIO_HIGH ? "high" : "low");
+  return ESP_OK;
+}
+
+esp_err_t stream_dispatch_add_ws(httpd_req_t *req) {
+  int sock = httpd_req_to_sockfd(req);
+  if (sock < 0) {
+    return ESP_FAIL;
+  }
+  frame_broadcast_touch();
+
+  xSemaphoreTake(clients_mutex, portMAX_DELAY);
+  stream_client_t *c = NULL;
+  for (int i = 0; i < MAX_STREAM_CLIENTS; i++) {
+    if (!clients[i].in_use) {
+      c = &clients[i];
+      break;
+    }
+  }
+  if (c) {
+    c->in_use = true;
+    c->sock = sock;
+    c->async_req = NULL;  // httpd keeps WS sessions alive itself
+    c->proto = STREAM_PROTO_WS;
+    c->mode = FRAME_MODE_LATEST;
+    c->variant = FRAME_VARIANT_FULL;
+    c->prio = STREAM_PRIO_LOW;  // browsers are best-effort consumers
+    c->fps = 0;
+    c->next_due_us = 0;
+    c->credits = 1;  // first frame goes out without waiting for an ACK
+    c->frames_sent = 0;
+    c->drops_reported = 0;
+    frame_cursor_init(&c->cursor);
+    metric_stream_clients++;
+  }
+  xSemaphoreGive(clients_mutex);
+
+  if (!c) {
+    Serial.println("Stream client table full, rejecting WS");
+    return ESP_FAIL;
+  }
+
+  Serial.println("WebSocket stream client connected");
+  return ESP_OK;
+}
+
+void stream_dispatch_ws_credit(int sock, int credits) {
+  xSemaphoreTake(clients_mutex, portMAX_DELAY);
+  for (int i = 0; i < MAX_STREAM_CLIENTS; i++) {
+    if (clients[i].in_use && clients[i].proto == STREAM_PROTO_WS &&
+        clients[i].sock == sock) {
+      clients[i].credits += credits;
+      break;
+    }
+  }
+  xSemaphoreGive(clients_mutex);
+}
@@ -0,0 +1,73 @@
+/*********
+  Async stream dispatcher for the ESP32-CAM streaming server
+
+  The stock esp_http_server dedicates one worker task to each request,
+  and a stream handler holds that worker forever - three viewers used
+  to pin three 8 KB stacks and starve the status page. Stream handlers
+  now detach their request with httpd_req_async_handler_begin() and
+  hand the socket to a single dispatcher task that multiplexes every
+  stream client, so httpd workers stay free for short requests.
+*********/
+
+#ifndef STREAM_DISPATCH_H
+#define STREAM_DISPATCH_H
+
+#include "esp_http_server.h"
+#include "frame_broadcast.h"
+
+// Maximum concurrent stream clients across all protocols
+#define MAX_STREAM_CLIENTS 6
+
+// Wire format for a dispatched client
+typedef enum {
+  STREAM_PROTO_MJPEG,  // multipart/x-mixed-replace (default /stream)
+  STREAM_PROTO_BIN,    // length-prefixed binary (/stream.bin)
+  STREAM_PROTO_WS,     // WebSocket binary frames with credit flow control (/ws)
+} stream_proto_t;
+
+// QoS tier (?prio=high). Each dispatch cycle serves every high-priority
+// client before any low-priority one, so a latency-critical consumer's
+// frames never queue behind a laggy viewer's send. Under contention
+// (high-priority clients present and the cycle overrunning its frame
+// budget) low-priority clients are additionally capped to a fraction of
+// the target FPS until the dispatcher catches back up.
+typedef enum {
+  STREAM_PRIO_LOW = 0,   // best effort (default)
+  STREAM_PRIO_HIGH,
+} stream_prio_t;
+
+// Target frame rate for the dispatch loop (settable via /control)
+extern volatile int stream_target_fps;
+
+// Start the dispatcher task; handle is used to close client sessions
+bool stream_dispatch_start(httpd_handle_t handle);
+
+// Detach the request and enqueue the client with the dispatcher. Sends
+// the raw response header block before detaching. variant selects the
+// published frame variant; client_fps caps this client's rate (0 follows
+// the shared stream_target_fps). On success the caller must return
+// ESP_OK without touching the request again.
+esp_err_t stream_dispatch_add(httpd_req_t *req, stream_proto_t proto,
+                              frame_mode_t mode, frame_variant_t variant,
+                              int client_fps, stream_prio_t prio);
+
+// Register an established WebSocket connection. The dispatcher pushes a
+// binary JPEG frame only while the client has send credit; each message
+// the client sends adds credit (its ASCII integer value, or 1).
+esp_err_t stream_dispatch_add_ws(httpd_req_t *req);
+
+// Grant credit to the WebSocket client on this socket
+void stream_dispatch_ws_credit(int sock, int credits);
+
+// Install as httpd's close_fn (config.close_fn). Reaps the matching
+// client entry whenever a session dies - required, because a client
+// that never triggers a send failure (e.g. a WebSocket viewer gone with
+// zero credits) would otherwise leak its slot forever - then closes the
+// descriptor, which is the close_fn's responsibility once overridden.
+void stream_dispatch_close_fn(httpd_handle_t hd, int sockfd);
+
+// Remove the client entry bound to this socket, if any (session is
+// assumed to be tearing down already)
+void stream_dispatch_sock_closed(int sock);
+
+#endif  // STREAM_DISPATCH_H